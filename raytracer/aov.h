@@ -0,0 +1,142 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// aov.h — Arbitrary output variables
+//
+// Per-pixel surface data written alongside the color during the trace.
+// Each requested pass is stored as full-resolution float planes, one per
+// channel, so consumers read a channel as one contiguous array.
+//
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <float.h>
+
+
+enum aovPass_t : uint32_t
+{
+	AOV_DEPTH,			// Mean hit distance along the camera ray
+	AOV_NORMAL,			// World space, xyz
+	AOV_ALBEDO,			// Linear rgb
+	AOV_MODEL_ID,
+	AOV_MATERIAL_ID,	// Index into RtScene::materials
+	AOV_SAMPLE_COUNT,
+	AOV_PASS_COUNT,
+};
+
+
+enum aovPassBit_t : uint32_t
+{
+	AOV_DEPTH_BIT			= ( 1 << AOV_DEPTH ),
+	AOV_NORMAL_BIT			= ( 1 << AOV_NORMAL ),
+	AOV_ALBEDO_BIT			= ( 1 << AOV_ALBEDO ),
+	AOV_MODEL_ID_BIT		= ( 1 << AOV_MODEL_ID ),
+	AOV_MATERIAL_ID_BIT		= ( 1 << AOV_MATERIAL_ID ),
+	AOV_SAMPLE_COUNT_BIT	= ( 1 << AOV_SAMPLE_COUNT ),
+};
+
+
+static const uint32_t	AovChannelCnt[ AOV_PASS_COUNT ]		= { 1, 3, 3, 1, 1, 1 };
+static const uint32_t	AovChannelOffset[ AOV_PASS_COUNT ]	= { 0, 1, 4, 7, 8, 9 };
+static const uint32_t	AovTotalChannels					= 10;
+
+// Passes the denoiser reads as edge-stopping guides
+static const uint32_t	DenoiseGuideMask	= AOV_DEPTH_BIT | AOV_NORMAL_BIT | AOV_ALBEDO_BIT;
+
+// Value of pixels no sample hit. Ids use -1 since 0 is a valid index.
+static const float		AovClearValue[ AOV_PASS_COUNT ]		= { FLT_MAX, 0.0f, 0.0f, -1.0f, -1.0f, 0.0f };
+
+
+class AovBuffers
+{
+public:
+	AovBuffers() : passMask( 0 ), width( 0 ), height( 0 ) {}
+
+	void			Init( const uint32_t passMask, const uint32_t width, const uint32_t height );
+
+	inline bool HasPass( const aovPass_t pass ) const
+	{
+		return ( passMask & ( 1u << pass ) ) != 0;
+	}
+
+	inline uint32_t GetPassMask() const
+	{
+		return passMask;
+	}
+
+	inline uint32_t GetWidth() const
+	{
+		return width;
+	}
+
+	inline uint32_t GetHeight() const
+	{
+		return height;
+	}
+
+	inline float* GetPlane( const aovPass_t pass, const uint32_t channel )
+	{
+		return planes[ AovChannelOffset[ pass ] + channel ].data();
+	}
+
+	inline const float* GetPlane( const aovPass_t pass, const uint32_t channel ) const
+	{
+		return planes[ AovChannelOffset[ pass ] + channel ].data();
+	}
+
+private:
+	std::vector<float>	planes[ AovTotalChannels ];
+	uint32_t			passMask;
+	uint32_t			width;
+	uint32_t			height;
+};
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline void AovBuffers::Init( const uint32_t passMask, const uint32_t width, const uint32_t height )
+{
+	this->passMask = passMask;
+	this->width = width;
+	this->height = height;
+
+	for ( uint32_t pass = 0; pass < AOV_PASS_COUNT; ++pass )
+	{
+		const bool requested = ( passMask & ( 1u << pass ) ) != 0;
+		for ( uint32_t c = 0; c < AovChannelCnt[ pass ]; ++c )
+		{
+			std::vector<float>& plane = planes[ AovChannelOffset[ pass ] + c ];
+			if ( requested ) {
+				plane.assign( width * height, AovClearValue[ pass ] );
+			} else {
+				plane.clear();
+			}
+		}
+	}
+}
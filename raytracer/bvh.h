@@ -0,0 +1,682 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// bvh.h — Bounding volume hierarchy
+//
+// Binned surface area heuristic builder over a list of primitive
+// bounds. Nodes are stored depth-first in a flat array: the first
+// child of an interior node always follows its parent, the second
+// child is referenced by offset.
+//
+
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+#include <float.h>
+#include <gfxcore/math/vector.h>
+#include <gfxcore/primitives/geom.h>
+#include <gfxcore/primitives/ray.h>
+
+
+// ============================================================
+// Types
+// ============================================================
+
+static const uint32_t	BvhMaxDepth		= 64;
+static const uint32_t	BvhBinCount		= 12;
+static const uint32_t	BvhMaxLeafPrims	= 16;
+static const float		BvhTraversalCost	= 1.0f;
+static const float		BvhRefitRebuildRatio	= 1.5f;	// Rebuild once refitting has made the tree this much worse
+static const uint32_t	PacketWidth		= 4;
+static const uint32_t	PacketRayCnt	= PacketWidth * PacketWidth;
+
+
+struct bvhNode_t
+{
+	AABB		bounds;
+	uint32_t	offset;		// Leaf: first index into primIndices, Interior: second child
+	uint16_t	primCnt;	// Zero for interior nodes
+	uint8_t		axis;
+	uint8_t		pad;
+};
+
+
+struct bvhStackEntry_t
+{
+	uint32_t	nodeIx;
+	float		tEntry;
+};
+
+
+// Ray with the reciprocal direction cached for slab tests. Parameterized
+// by Ray::GetVector() so t values match RayToTriangleIntersection().
+struct traceRay_t
+{
+	vec3f		o;
+	vec3f		d;
+	vec3f		invD;
+	uint32_t	dirIsNeg[ 3 ];
+};
+
+
+// Group of rays traversed together. Nodes are culled against interval
+// bounds of the packet's origins and reciprocal directions, which is only
+// valid while every ray shares the same direction signs.
+struct rayPacket_t
+{
+	traceRay_t	rays[ PacketRayCnt ];
+	uint32_t	rayCnt;
+	vec3f		oMin;
+	vec3f		oMax;
+	vec3f		invDMin;
+	vec3f		invDMax;
+	uint32_t	dirIsNeg[ 3 ];
+	bool		coherent;
+};
+
+
+class Bvh
+{
+public:
+	std::vector<bvhNode_t>	nodes;
+	std::vector<uint32_t>	primIndices;
+
+	void			Build( const std::vector<AABB>& primBounds, const uint32_t maxLeafSize );
+	void			Refit( const std::vector<AABB>& primBounds );
+	float			SahCost() const;
+	void			Clear();
+
+	inline bool IsEmpty() const
+	{
+		return nodes.empty();
+	}
+
+	inline const AABB& GetAABB() const
+	{
+		return nodes[ 0 ].bounds;
+	}
+
+private:
+	uint32_t		BuildRecursive( const std::vector<AABB>& primBounds, const std::vector<vec3f>& centroids, const uint32_t first, const uint32_t count, const uint32_t maxLeafSize, const uint32_t depth );
+};
+
+
+// ============================================================
+// Utility
+// ============================================================
+
+// Default constructed boxes are inverted; merging one must not widen the other
+inline bool IsEmptyBounds( const AABB& bounds )
+{
+	return ( bounds.min[ 0 ] > bounds.max[ 0 ] ) || ( bounds.min[ 1 ] > bounds.max[ 1 ] ) || ( bounds.min[ 2 ] > bounds.max[ 2 ] );
+}
+
+
+inline AABB Union( const AABB& a, const AABB& b )
+{
+	if ( IsEmptyBounds( b ) ) {
+		return a;
+	}
+	if ( IsEmptyBounds( a ) ) {
+		return b;
+	}
+
+	AABB bounds = a;
+	bounds.Expand( b.min );
+	bounds.Expand( b.max );
+	return bounds;
+}
+
+
+inline float SurfaceArea( const AABB& bounds )
+{
+	const vec3f extent = bounds.max - bounds.min;
+	if ( ( extent[ 0 ] < 0.0f ) || ( extent[ 1 ] < 0.0f ) || ( extent[ 2 ] < 0.0f ) ) {
+		return 0.0f;
+	}
+	return 2.0f * ( extent[ 0 ] * extent[ 1 ] + extent[ 1 ] * extent[ 2 ] + extent[ 2 ] * extent[ 0 ] );
+}
+
+
+inline vec3f Centroid( const AABB& bounds )
+{
+	return 0.5f * ( bounds.min + bounds.max );
+}
+
+
+inline traceRay_t MakeTraceRay( const vec3f& o, const vec3f& d )
+{
+	traceRay_t traceRay;
+	traceRay.o = o;
+	traceRay.d = d;
+	for ( uint32_t i = 0; i < 3; ++i )
+	{
+		// Avoid NaNs from 0 * inf in the slab test for axis aligned rays
+		const float di = ( fabs( d[ i ] ) > 1e-12f ) ? d[ i ] : ( d[ i ] < 0.0f ? -1e-12f : 1e-12f );
+		traceRay.invD[ i ] = 1.0f / di;
+		traceRay.dirIsNeg[ i ] = ( traceRay.invD[ i ] < 0.0f ) ? 1 : 0;
+	}
+	return traceRay;
+}
+
+
+inline traceRay_t MakeTraceRay( const Ray& ray )
+{
+	return MakeTraceRay( ray.o, ray.GetVector() );
+}
+
+
+inline bool IntersectAABB( const traceRay_t& ray, const AABB& bounds, const float tMax, float& tEntry )
+{
+	float t0 = 0.0f;
+	float t1 = tMax;
+	for ( uint32_t i = 0; i < 3; ++i )
+	{
+		float tNear = ( bounds.min[ i ] - ray.o[ i ] ) * ray.invD[ i ];
+		float tFar = ( bounds.max[ i ] - ray.o[ i ] ) * ray.invD[ i ];
+		if ( tNear > tFar ) {
+			std::swap( tNear, tFar );
+		}
+		t0 = std::max( t0, tNear );
+		t1 = std::min( t1, tFar );
+		if ( t0 > t1 ) {
+			return false;
+		}
+	}
+	tEntry = t0;
+	return true;
+}
+
+
+inline void FinalizePacket( rayPacket_t& packet )
+{
+	packet.coherent = ( packet.rayCnt > 0 );
+	if ( !packet.coherent ) {
+		return;
+	}
+
+	const traceRay_t& first = packet.rays[ 0 ];
+	packet.oMin = packet.oMax = first.o;
+	packet.invDMin = packet.invDMax = first.invD;
+	for ( uint32_t i = 0; i < 3; ++i ) {
+		packet.dirIsNeg[ i ] = first.dirIsNeg[ i ];
+	}
+
+	for ( uint32_t r = 1; r < packet.rayCnt; ++r )
+	{
+		const traceRay_t& ray = packet.rays[ r ];
+		for ( uint32_t i = 0; i < 3; ++i )
+		{
+			packet.oMin[ i ] = std::min( packet.oMin[ i ], ray.o[ i ] );
+			packet.oMax[ i ] = std::max( packet.oMax[ i ], ray.o[ i ] );
+			packet.invDMin[ i ] = std::min( packet.invDMin[ i ], ray.invD[ i ] );
+			packet.invDMax[ i ] = std::max( packet.invDMax[ i ], ray.invD[ i ] );
+			packet.coherent = packet.coherent && ( ray.dirIsNeg[ i ] == packet.dirIsNeg[ i ] );
+		}
+	}
+}
+
+
+inline float PacketMaxT( const rayPacket_t& packet, const float* tMax )
+{
+	float t = 0.0f;
+	for ( uint32_t r = 0; r < packet.rayCnt; ++r ) {
+		t = std::max( t, tMax[ r ] );
+	}
+	return t;
+}
+
+
+inline void IntervalMul( const float a0, const float a1, const float b0, const float b1, float& lo, float& hi )
+{
+	const float p0 = a0 * b0;
+	const float p1 = a0 * b1;
+	const float p2 = a1 * b0;
+	const float p3 = a1 * b1;
+	lo = std::min( std::min( p0, p1 ), std::min( p2, p3 ) );
+	hi = std::max( std::max( p0, p1 ), std::max( p2, p3 ) );
+}
+
+
+// Conservative test: false only if no ray in a coherent packet can hit the box
+inline bool IntersectPacketAABB( const rayPacket_t& packet, const AABB& bounds, const float tMax, float& tEntry )
+{
+	float t0 = 0.0f;
+	float t1 = tMax;
+	for ( uint32_t i = 0; i < 3; ++i )
+	{
+		const float nearPlane = packet.dirIsNeg[ i ] ? bounds.max[ i ] : bounds.min[ i ];
+		const float farPlane = packet.dirIsNeg[ i ] ? bounds.min[ i ] : bounds.max[ i ];
+
+		float nearLo;
+		float nearHi;
+		float farLo;
+		float farHi;
+		IntervalMul( nearPlane - packet.oMax[ i ], nearPlane - packet.oMin[ i ], packet.invDMin[ i ], packet.invDMax[ i ], nearLo, nearHi );
+		IntervalMul( farPlane - packet.oMax[ i ], farPlane - packet.oMin[ i ], packet.invDMin[ i ], packet.invDMax[ i ], farLo, farHi );
+
+		t0 = std::max( t0, nearLo );
+		t1 = std::min( t1, farHi );
+		if ( t0 > t1 ) {
+			return false;
+		}
+	}
+	tEntry = t0;
+	return true;
+}
+
+
+// Closest-first traversal with a fixed stack. Children are visited in order
+// of entry distance and subtrees entered beyond tMax are skipped, so the
+// leaf callback should shrink tMax as it finds closer hits. Returning true
+// from the callback ends traversal early.
+template<class LeafFunc>
+inline bool TraverseBvh( const Bvh& bvh, const traceRay_t& ray, const float& tMax, LeafFunc&& onLeaf )
+{
+	if ( bvh.IsEmpty() ) {
+		return false;
+	}
+
+	float tRoot;
+	if ( !IntersectAABB( ray, bvh.nodes[ 0 ].bounds, tMax, tRoot ) ) {
+		return false;
+	}
+
+	bvhStackEntry_t stack[ BvhMaxDepth ];
+	uint32_t stackSize = 0;
+	stack[ stackSize++ ] = { 0, tRoot };
+
+	while ( stackSize > 0 )
+	{
+		const bvhStackEntry_t entry = stack[ --stackSize ];
+		if ( entry.tEntry > tMax ) {
+			continue;
+		}
+
+		uint32_t nodeIx = entry.nodeIx;
+		while ( true )
+		{
+			const bvhNode_t& node = bvh.nodes[ nodeIx ];
+			if ( node.primCnt > 0 )
+			{
+				if ( onLeaf( node ) ) {
+					return true;
+				}
+				break;
+			}
+
+			const uint32_t leftIx = nodeIx + 1;
+			const uint32_t rightIx = node.offset;
+
+			float tLeft;
+			float tRight;
+			const bool hitLeft = IntersectAABB( ray, bvh.nodes[ leftIx ].bounds, tMax, tLeft );
+			const bool hitRight = IntersectAABB( ray, bvh.nodes[ rightIx ].bounds, tMax, tRight );
+
+			if ( hitLeft && hitRight )
+			{
+				if ( tLeft <= tRight )
+				{
+					stack[ stackSize++ ] = { rightIx, tRight };
+					nodeIx = leftIx;
+				}
+				else
+				{
+					stack[ stackSize++ ] = { leftIx, tLeft };
+					nodeIx = rightIx;
+				}
+			}
+			else if ( hitLeft )
+			{
+				nodeIx = leftIx;
+			}
+			else if ( hitRight )
+			{
+				nodeIx = rightIx;
+			}
+			else
+			{
+				break;
+			}
+		}
+	}
+
+	return false;
+}
+
+
+// Any-hit traversal for occlusion queries. Children are pushed without
+// sorting since any hit inside [0, tMax] ends the query; returns true as soon
+// as the leaf callback does.
+template<class LeafFunc>
+inline bool TraverseBvhAny( const Bvh& bvh, const traceRay_t& ray, const float tMax, LeafFunc&& onLeaf )
+{
+	if ( bvh.IsEmpty() ) {
+		return false;
+	}
+
+	float tEntry;
+	if ( !IntersectAABB( ray, bvh.nodes[ 0 ].bounds, tMax, tEntry ) ) {
+		return false;
+	}
+
+	uint32_t stack[ BvhMaxDepth ];
+	uint32_t stackSize = 0;
+	stack[ stackSize++ ] = 0;
+
+	while ( stackSize > 0 )
+	{
+		const bvhNode_t& node = bvh.nodes[ stack[ --stackSize ] ];
+		if ( node.primCnt > 0 )
+		{
+			if ( onLeaf( node ) ) {
+				return true;
+			}
+			continue;
+		}
+
+		const uint32_t leftIx = static_cast<uint32_t>( &node - bvh.nodes.data() ) + 1;
+		const uint32_t rightIx = node.offset;
+
+		if ( IntersectAABB( ray, bvh.nodes[ rightIx ].bounds, tMax, tEntry ) ) {
+			stack[ stackSize++ ] = rightIx;
+		}
+		if ( IntersectAABB( ray, bvh.nodes[ leftIx ].bounds, tMax, tEntry ) ) {
+			stack[ stackSize++ ] = leftIx;
+		}
+	}
+
+	return false;
+}
+
+
+// Packet version of TraverseBvh for coherent packets. tMax holds the current
+// closest hit of each ray and is updated by the leaf callback. The near child
+// is chosen from the shared direction signs.
+template<class LeafFunc>
+inline void TraverseBvhPacket( const Bvh& bvh, const rayPacket_t& packet, const float* tMax, LeafFunc&& onLeaf )
+{
+	if ( bvh.IsEmpty() ) {
+		return;
+	}
+
+	bvhStackEntry_t stack[ BvhMaxDepth ];
+	uint32_t stackSize = 0;
+	stack[ stackSize++ ] = { 0, 0.0f };
+
+	while ( stackSize > 0 )
+	{
+		const bvhStackEntry_t entry = stack[ --stackSize ];
+		const float packetT = PacketMaxT( packet, tMax );
+		if ( entry.tEntry > packetT ) {
+			continue;
+		}
+
+		uint32_t nodeIx = entry.nodeIx;
+		while ( true )
+		{
+			const bvhNode_t& node = bvh.nodes[ nodeIx ];
+
+			float tEntry;
+			if ( !IntersectPacketAABB( packet, node.bounds, packetT, tEntry ) ) {
+				break;
+			}
+
+			if ( node.primCnt > 0 )
+			{
+				onLeaf( node );
+				break;
+			}
+
+			if ( packet.dirIsNeg[ node.axis ] )
+			{
+				stack[ stackSize++ ] = { nodeIx + 1, tEntry };
+				nodeIx = node.offset;
+			}
+			else
+			{
+				stack[ stackSize++ ] = { node.offset, tEntry };
+				nodeIx = nodeIx + 1;
+			}
+		}
+	}
+}
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline void Bvh::Clear()
+{
+	nodes.clear();
+	primIndices.clear();
+}
+
+
+// Recomputes node bounds for moved primitives while keeping the topology.
+// Only valid while primIndices still refers into primBounds, so not for
+// trees whose leaves were repacked.
+inline void Bvh::Refit( const std::vector<AABB>& primBounds )
+{
+	// Children always follow their parent, so a reverse sweep is bottom up
+	for ( size_t n = nodes.size(); n-- > 0; )
+	{
+		bvhNode_t& node = nodes[ n ];
+		if ( node.primCnt > 0 )
+		{
+			AABB bounds;
+			for ( uint32_t i = 0; i < node.primCnt; ++i ) {
+				bounds = Union( bounds, primBounds[ primIndices[ node.offset + i ] ] );
+			}
+			node.bounds = bounds;
+		}
+		else
+		{
+			node.bounds = Union( nodes[ n + 1 ].bounds, nodes[ node.offset ].bounds );
+		}
+	}
+}
+
+
+// Expected cost of a random ray through the tree relative to its root.
+// Comparing it before and after a refit tells how much the tree degraded.
+inline float Bvh::SahCost() const
+{
+	if ( IsEmpty() ) {
+		return 0.0f;
+	}
+
+	const float rootArea = std::max( SurfaceArea( nodes[ 0 ].bounds ), FLT_MIN );
+	float cost = 0.0f;
+	for ( const bvhNode_t& node : nodes )
+	{
+		const float nodeCost = ( node.primCnt > 0 ) ? static_cast<float>( node.primCnt ) : BvhTraversalCost;
+		cost += nodeCost * SurfaceArea( node.bounds ) / rootArea;
+	}
+	return cost;
+}
+
+
+inline void Bvh::Build( const std::vector<AABB>& primBounds, const uint32_t maxLeafSize )
+{
+	Clear();
+
+	const uint32_t primCnt = static_cast<uint32_t>( primBounds.size() );
+	if ( primCnt == 0 ) {
+		return;
+	}
+
+	std::vector<vec3f> centroids( primCnt );
+	primIndices.resize( primCnt );
+	for ( uint32_t i = 0; i < primCnt; ++i )
+	{
+		centroids[ i ] = Centroid( primBounds[ i ] );
+		primIndices[ i ] = i;
+	}
+
+	nodes.reserve( 2 * primCnt - 1 );
+	BuildRecursive( primBounds, centroids, 0, primCnt, std::max( 1u, maxLeafSize ), 0 );
+	nodes.shrink_to_fit();
+}
+
+
+inline uint32_t Bvh::BuildRecursive( const std::vector<AABB>& primBounds, const std::vector<vec3f>& centroids, const uint32_t first, const uint32_t count, const uint32_t maxLeafSize, const uint32_t depth )
+{
+	const uint32_t nodeIx = static_cast<uint32_t>( nodes.size() );
+	nodes.push_back( bvhNode_t() );
+
+	AABB bounds;
+	AABB centroidBounds;
+	for ( uint32_t i = first; i < ( first + count ); ++i )
+	{
+		const uint32_t primIx = primIndices[ i ];
+		bounds = Union( bounds, primBounds[ primIx ] );
+		centroidBounds.Expand( centroids[ primIx ] );
+	}
+
+	bvhNode_t node;
+	node.bounds = bounds;
+	node.offset = first;
+	node.primCnt = static_cast<uint16_t>( count );
+	node.axis = 0;
+	node.pad = 0;
+
+	const vec3f extent = centroidBounds.max - centroidBounds.min;
+	uint32_t axis = 0;
+	if ( extent[ 1 ] > extent[ axis ] ) {
+		axis = 1;
+	}
+	if ( extent[ 2 ] > extent[ axis ] ) {
+		axis = 2;
+	}
+
+	const bool canSplit = ( count > maxLeafSize ) && ( extent[ axis ] > 0.0f ) && ( ( depth + 1 ) < BvhMaxDepth );
+	if ( !canSplit && ( count <= 0xFFFF ) )
+	{
+		nodes[ nodeIx ] = node;
+		return nodeIx;
+	}
+
+	// Bin centroids along the widest axis and sweep for the cheapest split
+	struct bin_t
+	{
+		AABB		bounds;
+		uint32_t	count = 0;
+	};
+	bin_t bins[ BvhBinCount ];
+
+	const float axisMin = centroidBounds.min[ axis ];
+	const float binScale = ( extent[ axis ] > 0.0f ) ? ( BvhBinCount / extent[ axis ] ) : 0.0f;
+	auto BinIndex = [&]( const uint32_t primIx ) -> uint32_t {
+		const uint32_t b = static_cast<uint32_t>( ( centroids[ primIx ][ axis ] - axisMin ) * binScale );
+		return std::min( b, BvhBinCount - 1 );
+	};
+
+	for ( uint32_t i = first; i < ( first + count ); ++i )
+	{
+		const uint32_t primIx = primIndices[ i ];
+		bin_t& bin = bins[ BinIndex( primIx ) ];
+		bin.bounds = Union( bin.bounds, primBounds[ primIx ] );
+		++bin.count;
+	}
+
+	float rightArea[ BvhBinCount ];
+	uint32_t rightCount[ BvhBinCount ];
+	{
+		AABB rightBounds;
+		uint32_t rightCnt = 0;
+		for ( uint32_t b = BvhBinCount - 1; b > 0; --b )
+		{
+			if ( bins[ b ].count > 0 )
+			{
+				rightBounds = Union( rightBounds, bins[ b ].bounds );
+				rightCnt += bins[ b ].count;
+			}
+			rightArea[ b ] = SurfaceArea( rightBounds );
+			rightCount[ b ] = rightCnt;
+		}
+	}
+
+	const float parentArea = std::max( SurfaceArea( bounds ), FLT_MIN );
+	float bestCost = FLT_MAX;
+	uint32_t bestSplit = 1;
+	{
+		AABB leftBounds;
+		uint32_t leftCnt = 0;
+		for ( uint32_t b = 1; b < BvhBinCount; ++b )
+		{
+			if ( bins[ b - 1 ].count > 0 )
+			{
+				leftBounds = Union( leftBounds, bins[ b - 1 ].bounds );
+				leftCnt += bins[ b - 1 ].count;
+			}
+			if ( ( leftCnt == 0 ) || ( rightCount[ b ] == 0 ) ) {
+				continue;
+			}
+			const float cost = BvhTraversalCost + ( SurfaceArea( leftBounds ) * leftCnt + rightArea[ b ] * rightCount[ b ] ) / parentArea;
+			if ( cost < bestCost )
+			{
+				bestCost = cost;
+				bestSplit = b;
+			}
+		}
+	}
+
+	const float leafCost = static_cast<float>( count );
+	if ( ( maxLeafSize > 1 ) && ( count <= BvhMaxLeafPrims ) && ( bestCost >= leafCost ) )
+	{
+		nodes[ nodeIx ] = node;
+		return nodeIx;
+	}
+
+	uint32_t* begin = primIndices.data() + first;
+	uint32_t* end = begin + count;
+	uint32_t* mid = std::partition( begin, end, [&]( const uint32_t primIx ) {
+		return BinIndex( primIx ) < bestSplit;
+	} );
+
+	uint32_t leftCnt = static_cast<uint32_t>( mid - begin );
+	if ( ( leftCnt == 0 ) || ( leftCnt == count ) )
+	{
+		// Degenerate binning, fall back to a median split
+		leftCnt = count / 2;
+		std::nth_element( begin, begin + leftCnt, end, [&]( const uint32_t a, const uint32_t b ) {
+			return centroids[ a ][ axis ] < centroids[ b ][ axis ];
+		} );
+	}
+
+	BuildRecursive( primBounds, centroids, first, leftCnt, maxLeafSize, depth + 1 );
+	const uint32_t rightIx = BuildRecursive( primBounds, centroids, first + leftCnt, count - leftCnt, maxLeafSize, depth + 1 );
+
+	node.offset = rightIx;
+	node.primCnt = 0;
+	node.axis = static_cast<uint8_t>( axis );
+	nodes[ nodeIx ] = node;
+
+	return nodeIx;
+}
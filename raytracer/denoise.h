@@ -0,0 +1,285 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// denoise.h — Edge-aware à-trous filter
+//
+// Requires: raytrace.h
+//
+// Smooths a low sample count frame with a 5x5 B-spline kernel applied at
+// doubling strides. Weights fall off across changes in normal, depth and
+// color, so edges survive while noise within a surface is averaged away.
+// Color is divided by albedo before filtering so texture detail is not
+// blurred, and multiplied back afterwards. Guides come from the depth,
+// normal and albedo AOV passes; pixels no camera ray hit are left alone.
+//
+// Each pass is split into row bands. DenoiseImage() runs them on the pool
+// and blocks; RenderJob queues them one pass after another instead.
+//
+
+#include "raytrace.h"
+
+
+struct denoiseSettings_t
+{
+	uint32_t	passCnt;		// Stride doubles every pass, 5 covers a 61 pixel footprint
+	float		sigmaColor;		// Halved every pass as the noise drops
+	float		normalPower;	// Exponent on the normal cosine
+	float		sigmaDepth;		// Relative to the center depth, per pixel of stride
+};
+
+
+static const uint32_t	DenoiseBandRows		= 16;
+static const float		DenoiseMinAlbedo	= 0.01f;
+
+
+class Denoiser
+{
+public:
+	Denoiser() : width( 0 ), height( 0 ), aov( nullptr ) {}
+
+	// Reads the frame and guides. Fails if a guide pass was not rendered,
+	// does not match the image size, or the image is empty.
+	bool			Begin( const ImageBuffer<Color>& image, const AovBuffers& aov, const denoiseSettings_t& settings );
+	void			FilterBand( const uint32_t pass, const uint32_t band );
+	void			End( ImageBuffer<Color>& image ) const;
+
+	inline uint32_t GetPassCount() const
+	{
+		return settings.passCnt;
+	}
+
+	inline uint32_t GetBandCount() const
+	{
+		return ( height + DenoiseBandRows - 1 ) / DenoiseBandRows;
+	}
+
+private:
+	denoiseSettings_t	settings;
+	uint32_t			width;
+	uint32_t			height;
+	const AovBuffers*	aov;
+	std::vector<vec3f>	color[ 2 ];		// Albedo-divided linear color, ping-ponged between passes
+	std::vector<vec3f>	albedo;
+	std::vector<uint8_t>	hit;
+};
+
+
+// ============================================================
+// Forward declarations
+// ============================================================
+
+denoiseSettings_t	DefaultDenoiseSettings();
+float		SrgbChannelToLinear( const float c );
+void		DenoiseImage( ThreadPool& pool, ImageBuffer<Color>& image, const AovBuffers& aov, const denoiseSettings_t& settings );
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline denoiseSettings_t DefaultDenoiseSettings()
+{
+	denoiseSettings_t settings;
+	settings.passCnt = 5;
+	settings.sigmaColor = 0.5f;
+	settings.normalPower = 64.0f;
+	settings.sigmaDepth = 0.02f;
+	return settings;
+}
+
+
+inline float SrgbChannelToLinear( const float c )
+{
+	return ( c <= 0.04045f ) ? ( c / 12.92f ) : powf( ( c + 0.055f ) / 1.055f, 2.4f );
+}
+
+
+inline bool Denoiser::Begin( const ImageBuffer<Color>& image, const AovBuffers& aov, const denoiseSettings_t& settings )
+{
+	if ( ( aov.GetPassMask() & DenoiseGuideMask ) != DenoiseGuideMask ) {
+		return false;
+	}
+	if ( ( aov.GetWidth() != image.GetWidth() ) || ( aov.GetHeight() != image.GetHeight() ) || ( image.GetWidth() == 0 ) || ( image.GetHeight() == 0 ) ) {
+		return false;
+	}
+
+	this->settings = settings;
+	this->aov = &aov;
+	width = image.GetWidth();
+	height = image.GetHeight();
+
+	const size_t pixelCnt = width * height;
+	color[ 0 ].resize( pixelCnt );
+	color[ 1 ].resize( pixelCnt );
+	albedo.resize( pixelCnt );
+	hit.resize( pixelCnt );
+
+	const float* depth = aov.GetPlane( AOV_DEPTH, 0 );
+	const float* albedoPlanes[ 3 ] = { aov.GetPlane( AOV_ALBEDO, 0 ), aov.GetPlane( AOV_ALBEDO, 1 ), aov.GetPlane( AOV_ALBEDO, 2 ) };
+
+	for ( uint32_t y = 0; y < height; ++y )
+	{
+		for ( uint32_t x = 0; x < width; ++x )
+		{
+			const size_t i = y * width + x;
+			hit[ i ] = ( depth[ i ] != AovClearValue[ AOV_DEPTH ] ) ? 1 : 0;
+
+			const vec4f srgb = ColorToVector( Color( image.GetPixel( x, y ) ) );
+			for ( uint32_t c = 0; c < 3; ++c )
+			{
+				// Dark albedo channels are left modulated rather than amplified
+				const float a = albedoPlanes[ c ][ i ];
+				albedo[ i ][ c ] = ( a > DenoiseMinAlbedo ) ? a : 1.0f;
+				color[ 0 ][ i ][ c ] = SrgbChannelToLinear( srgb[ c ] ) / albedo[ i ][ c ];
+			}
+		}
+	}
+	return true;
+}
+
+
+// Reads the output of the previous pass and writes rows
+// [ band * DenoiseBandRows, ( band + 1 ) * DenoiseBandRows ) of this one.
+// Bands of the same pass are independent.
+inline void Denoiser::FilterBand( const uint32_t pass, const uint32_t band )
+{
+	static const float kernel[ 3 ] = { 3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f };
+
+	const std::vector<vec3f>& src = color[ pass & 1 ];
+	std::vector<vec3f>& dst = color[ ( pass + 1 ) & 1 ];
+
+	const int32_t stride = 1 << pass;
+	const float sigmaColor = settings.sigmaColor / static_cast<float>( stride );
+	const float invColorVar = 1.0f / std::max( sigmaColor * sigmaColor, FLT_MIN );
+
+	const float* depth = aov->GetPlane( AOV_DEPTH, 0 );
+	const float* normals[ 3 ] = { aov->GetPlane( AOV_NORMAL, 0 ), aov->GetPlane( AOV_NORMAL, 1 ), aov->GetPlane( AOV_NORMAL, 2 ) };
+
+	const uint32_t yBegin = band * DenoiseBandRows;
+	const uint32_t yEnd = std::min( yBegin + DenoiseBandRows, height );
+	for ( uint32_t y = yBegin; y < yEnd; ++y )
+	{
+		for ( uint32_t x = 0; x < width; ++x )
+		{
+			const size_t center = y * width + x;
+			if ( hit[ center ] == 0 )
+			{
+				dst[ center ] = src[ center ];
+				continue;
+			}
+
+			const vec3f centerColor = src[ center ];
+			const vec3f centerNormal = vec3f( normals[ 0 ][ center ], normals[ 1 ][ center ], normals[ 2 ][ center ] );
+			const float depthScale = 1.0f / std::max( settings.sigmaDepth * depth[ center ] * stride, FLT_MIN );
+
+			vec3f sum = vec3f( 0.0f );
+			float weightSum = 0.0f;
+			for ( int32_t dy = -2; dy <= 2; ++dy )
+			{
+				const int32_t sy = static_cast<int32_t>( y ) + dy * stride;
+				if ( ( sy < 0 ) || ( sy >= static_cast<int32_t>( height ) ) ) {
+					continue;
+				}
+
+				for ( int32_t dx = -2; dx <= 2; ++dx )
+				{
+					const int32_t sx = static_cast<int32_t>( x ) + dx * stride;
+					if ( ( sx < 0 ) || ( sx >= static_cast<int32_t>( width ) ) ) {
+						continue;
+					}
+
+					const size_t tap = sy * width + sx;
+					if ( hit[ tap ] == 0 ) {
+						continue;
+					}
+
+					const vec3f tapNormal = vec3f( normals[ 0 ][ tap ], normals[ 1 ][ tap ], normals[ 2 ][ tap ] );
+					const float cosine = std::max( 0.0f, Dot( centerNormal, tapNormal ) );
+					const float normalWeight = powf( cosine, settings.normalPower );
+					if ( normalWeight <= 0.0f ) {
+						continue;
+					}
+
+					const vec3f colorDelta = src[ tap ] - centerColor;
+					const float colorWeight = expf( -Dot( colorDelta, colorDelta ) * invColorVar );
+					const float depthWeight = expf( -fabs( depth[ tap ] - depth[ center ] ) * depthScale );
+
+					const float weight = kernel[ std::abs( dx ) ] * kernel[ std::abs( dy ) ] * normalWeight * colorWeight * depthWeight;
+					sum += weight * src[ tap ];
+					weightSum += weight;
+				}
+			}
+
+			// Only a degenerate center normal can leave no weight
+			dst[ center ] = ( weightSum > 0.0f ) ? ( 1.0f / weightSum ) * sum : centerColor;
+		}
+	}
+}
+
+
+// Writes the filtered color back over pixels a camera ray hit
+inline void Denoiser::End( ImageBuffer<Color>& image ) const
+{
+	const std::vector<vec3f>& result = color[ settings.passCnt & 1 ];
+	for ( uint32_t y = 0; y < height; ++y )
+	{
+		for ( uint32_t x = 0; x < width; ++x )
+		{
+			const size_t i = y * width + x;
+			if ( hit[ i ] == 0 ) {
+				continue;
+			}
+
+			const float alpha = ColorToVector( Color( image.GetPixel( x, y ) ) )[ 3 ];
+			const vec3f& c = result[ i ];
+			const vec3f& a = albedo[ i ];
+
+			Color dst = Color( LinearToSrgb( Vec4ToColor( vec4f( c[ 0 ] * a[ 0 ], c[ 1 ] * a[ 1 ], c[ 2 ] * a[ 2 ], 1.0f ) ) ) );
+			dst.a() = alpha;
+			image.SetPixel( x, y, dst );
+		}
+	}
+}
+
+
+inline void DenoiseImage( ThreadPool& pool, ImageBuffer<Color>& image, const AovBuffers& aov, const denoiseSettings_t& settings )
+{
+	Denoiser denoiser;
+	if ( !denoiser.Begin( image, aov, settings ) ) {
+		return;
+	}
+
+	const uint32_t bandCnt = denoiser.GetBandCount();
+	for ( uint32_t pass = 0; pass < denoiser.GetPassCount(); ++pass )
+	{
+		for ( uint32_t band = 0; band < bandCnt; ++band ) {
+			pool.Submit( [&denoiser, pass, band]() { denoiser.FilterBand( pass, band ); } );
+		}
+		pool.Wait();
+	}
+
+	denoiser.End( image );
+}
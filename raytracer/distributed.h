@@ -0,0 +1,812 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// distributed.h — Tile rendering across worker processes
+//
+// Requires: raytrace.h
+//
+// A coordinator listens on a Unix domain socket and hands out tiles to any
+// worker process that connects. Workers build the same scene and view,
+// trace tiles on their own thread pool and send back the resolved tile
+// buffers, which the coordinator writes into the frame. A worker that
+// disconnects or goes quiet has its outstanding tiles handed to others.
+// The coordinator reads its sockets without blocking, so one stalled worker
+// cannot hold up the rest. When no worker is available it gives up and
+// reports the tiles still missing, which the caller traces locally.
+//
+// Messages are a fixed header followed by a raw payload. Both ends are
+// expected to run the same build on the same machine, so values are sent
+// in native byte order.
+//
+
+#include "raytrace.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+
+#if defined( _WIN32 )
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <afunix.h>
+#pragma comment( lib, "ws2_32.lib" )
+typedef SOCKET socket_t;
+static const socket_t	InvalidSocket	= INVALID_SOCKET;
+#define NET_NOSIGNAL	0
+#define NET_POLL		WSAPoll
+#else
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+typedef int socket_t;
+static const socket_t	InvalidSocket	= -1;
+#define NET_NOSIGNAL	MSG_NOSIGNAL
+#define NET_POLL		poll
+#endif
+
+
+static const uint32_t	NetMaxPayload			= 64 * 1024 * 1024;
+static const int		NetPollIntervalMs		= 100;
+static const int		NetSendTimeoutMs		= 5000;
+static const uint32_t	NetMaxInFlight			= 256;
+static const double		DefaultWorkerTimeoutMs	= 30000.0;
+static const double		DefaultConnectTimeoutMs	= 10000.0;
+
+
+enum netMsgType_t : uint32_t
+{
+	NET_MSG_HELLO,			// Worker -> coordinator: netHello_t
+	NET_MSG_TILE_JOB,		// Coordinator -> worker: netTileJob_t
+	NET_MSG_TILE_RESULT,	// Worker -> coordinator: netTileJob_t, then the tile buffer
+	NET_MSG_DONE,			// Coordinator -> worker: no more tiles
+};
+
+
+enum netParse_t : uint32_t
+{
+	NET_PARSE_INCOMPLETE,
+	NET_PARSE_MESSAGE,
+	NET_PARSE_INVALID,
+};
+
+
+struct netMsgHeader_t
+{
+	uint32_t	type;
+	uint32_t	size;
+};
+
+
+struct netHello_t
+{
+	uint32_t	maxInFlight;	// Tiles the worker wants queued at once
+};
+
+
+struct netTileJob_t
+{
+	uint32_t	tileIx;
+	int32_t		x0;
+	int32_t		y0;
+	int32_t		x1;
+	int32_t		y1;
+	uint32_t	aovMask;
+};
+
+
+// ============================================================
+// Forward declarations
+// ============================================================
+
+bool		NetInit();
+void		CloseSocket( const socket_t s );
+socket_t	ListenUnixSocket( const char* path );
+socket_t	ConnectUnixSocket( const char* path );
+bool		SetNonBlocking( const socket_t s );
+bool		SendAll( const socket_t s, const void* data, const size_t size );
+bool		RecvAll( const socket_t s, void* data, const size_t size );
+bool		RecvAvailable( const socket_t s, std::vector<uint8_t>& buffer );
+bool		SendNetMessage( const socket_t s, const netMsgType_t type, const std::vector<uint8_t>& payload );
+bool		RecvNetMessage( const socket_t s, netMsgType_t& outType, std::vector<uint8_t>& outPayload );
+netParse_t	TakeNetMessage( std::vector<uint8_t>& buffer, netMsgType_t& outType, std::vector<uint8_t>& outPayload );
+bool		IsSameTileJob( const netTileJob_t& a, const netTileJob_t& b );
+size_t		TilePayloadSize( const uint32_t width, const uint32_t height, const uint32_t aovMask );
+void		SerializeTile( const tileBuffer_t& tile, std::vector<uint8_t>& payload );
+bool		DeserializeTile( const uint8_t* data, const size_t size, const netTileJob_t& job, tileBuffer_t& outTile );
+bool		RunRenderWorker( const char* socketPath, ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings );
+bool		TraceSceneDistributed( const char* socketPath, const RtView& view, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, std::vector<netTileJob_t>& outMissing, const double workerTimeoutMs = DefaultWorkerTimeoutMs, const double connectTimeoutMs = DefaultConnectTimeoutMs );
+void		TraceTilesLocal( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, const std::vector<netTileJob_t>& tiles, ImageBuffer<Color>& image, debug_t& dbg );
+
+
+// ============================================================
+// Sockets
+// ============================================================
+
+inline bool NetInit()
+{
+#if defined( _WIN32 )
+	static const bool initialized = []()
+	{
+		WSADATA wsaData;
+		return ( WSAStartup( MAKEWORD( 2, 2 ), &wsaData ) == 0 );
+	}();
+	return initialized;
+#else
+	return true;
+#endif
+}
+
+
+inline void CloseSocket( const socket_t s )
+{
+#if defined( _WIN32 )
+	closesocket( s );
+#else
+	close( s );
+#endif
+}
+
+
+inline bool MakeUnixAddress( const char* path, sockaddr_un& outAddr )
+{
+	std::memset( &outAddr, 0, sizeof( outAddr ) );
+	outAddr.sun_family = AF_UNIX;
+	if ( std::strlen( path ) >= sizeof( outAddr.sun_path ) ) {
+		return false;
+	}
+	std::strncpy( outAddr.sun_path, path, sizeof( outAddr.sun_path ) - 1 );
+	return true;
+}
+
+
+inline socket_t ListenUnixSocket( const char* path )
+{
+	sockaddr_un addr;
+	if ( !NetInit() || !MakeUnixAddress( path, addr ) ) {
+		return InvalidSocket;
+	}
+
+	const socket_t s = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( s == InvalidSocket ) {
+		return InvalidSocket;
+	}
+
+	// A stale socket file from an earlier run would make bind fail
+	remove( path );
+	if ( ( bind( s, reinterpret_cast<const sockaddr*>( &addr ), sizeof( addr ) ) != 0 ) || ( listen( s, 16 ) != 0 ) )
+	{
+		CloseSocket( s );
+		return InvalidSocket;
+	}
+	return s;
+}
+
+
+inline socket_t ConnectUnixSocket( const char* path )
+{
+	sockaddr_un addr;
+	if ( !NetInit() || !MakeUnixAddress( path, addr ) ) {
+		return InvalidSocket;
+	}
+
+	const socket_t s = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( s == InvalidSocket ) {
+		return InvalidSocket;
+	}
+
+	if ( connect( s, reinterpret_cast<const sockaddr*>( &addr ), sizeof( addr ) ) != 0 )
+	{
+		CloseSocket( s );
+		return InvalidSocket;
+	}
+	return s;
+}
+
+
+inline bool SetNonBlocking( const socket_t s )
+{
+#if defined( _WIN32 )
+	u_long mode = 1;
+	return ( ioctlsocket( s, FIONBIO, &mode ) == 0 );
+#else
+	const int flags = fcntl( s, F_GETFL, 0 );
+	return ( flags >= 0 ) && ( fcntl( s, F_SETFL, flags | O_NONBLOCK ) == 0 );
+#endif
+}
+
+
+inline bool NetWouldBlock()
+{
+#if defined( _WIN32 )
+	return ( WSAGetLastError() == WSAEWOULDBLOCK );
+#else
+	return ( errno == EAGAIN ) || ( errno == EWOULDBLOCK );
+#endif
+}
+
+
+// Works on non-blocking sockets too, waiting up to NetSendTimeoutMs for room
+inline bool SendAll( const socket_t s, const void* data, const size_t size )
+{
+	const char* bytes = static_cast<const char*>( data );
+	size_t sent = 0;
+	while ( sent < size )
+	{
+		const int chunk = static_cast<int>( std::min<size_t>( size - sent, 1 << 20 ) );
+		const int n = send( s, bytes + sent, chunk, NET_NOSIGNAL );
+		if ( n > 0 )
+		{
+			sent += n;
+			continue;
+		}
+		if ( ( n == 0 ) || !NetWouldBlock() ) {
+			return false;
+		}
+
+		pollfd fd;
+		fd.fd = s;
+		fd.events = POLLOUT;
+		fd.revents = 0;
+		if ( NET_POLL( &fd, 1, NetSendTimeoutMs ) <= 0 ) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+inline bool RecvAll( const socket_t s, void* data, const size_t size )
+{
+	char* bytes = static_cast<char*>( data );
+	size_t received = 0;
+	while ( received < size )
+	{
+		const int chunk = static_cast<int>( std::min<size_t>( size - received, 1 << 20 ) );
+		const int n = recv( s, bytes + received, chunk, 0 );
+		if ( n <= 0 ) {
+			return false;
+		}
+		received += n;
+	}
+	return true;
+}
+
+
+// Appends whatever a non-blocking socket has ready. Returns false once the
+// peer has closed or the connection failed.
+inline bool RecvAvailable( const socket_t s, std::vector<uint8_t>& buffer )
+{
+	char chunk[ 64 * 1024 ];
+	for ( ;; )
+	{
+		const int n = recv( s, chunk, static_cast<int>( sizeof( chunk ) ), 0 );
+		if ( n > 0 )
+		{
+			buffer.insert( buffer.end(), chunk, chunk + n );
+			continue;
+		}
+		return ( n < 0 ) && NetWouldBlock();
+	}
+}
+
+
+inline bool SendNetMessage( const socket_t s, const netMsgType_t type, const std::vector<uint8_t>& payload )
+{
+	netMsgHeader_t header;
+	header.type = type;
+	header.size = static_cast<uint32_t>( payload.size() );
+	return SendAll( s, &header, sizeof( header ) ) && SendAll( s, payload.data(), payload.size() );
+}
+
+
+inline bool RecvNetMessage( const socket_t s, netMsgType_t& outType, std::vector<uint8_t>& outPayload )
+{
+	netMsgHeader_t header;
+	if ( !RecvAll( s, &header, sizeof( header ) ) || ( header.size > NetMaxPayload ) ) {
+		return false;
+	}
+
+	outType = static_cast<netMsgType_t>( header.type );
+	outPayload.resize( header.size );
+	return RecvAll( s, outPayload.data(), header.size );
+}
+
+
+// Splits the first complete message off the front of a receive buffer
+inline netParse_t TakeNetMessage( std::vector<uint8_t>& buffer, netMsgType_t& outType, std::vector<uint8_t>& outPayload )
+{
+	if ( buffer.size() < sizeof( netMsgHeader_t ) ) {
+		return NET_PARSE_INCOMPLETE;
+	}
+
+	netMsgHeader_t header;
+	std::memcpy( &header, buffer.data(), sizeof( header ) );
+	if ( header.size > NetMaxPayload ) {
+		return NET_PARSE_INVALID;
+	}
+
+	const size_t msgSize = sizeof( header ) + header.size;
+	if ( buffer.size() < msgSize ) {
+		return NET_PARSE_INCOMPLETE;
+	}
+
+	outType = static_cast<netMsgType_t>( header.type );
+	outPayload.assign( buffer.begin() + sizeof( header ), buffer.begin() + msgSize );
+	buffer.erase( buffer.begin(), buffer.begin() + msgSize );
+	return NET_PARSE_MESSAGE;
+}
+
+
+// ============================================================
+// Tile payloads
+// ============================================================
+
+template<class T>
+inline void AppendPod( std::vector<uint8_t>& payload, const T* values, const size_t count )
+{
+	const uint8_t* bytes = reinterpret_cast<const uint8_t*>( values );
+	payload.insert( payload.end(), bytes, bytes + count * sizeof( T ) );
+}
+
+
+template<class T>
+inline bool ReadPod( const uint8_t* data, const size_t size, size_t& offset, T* outValues, const size_t count )
+{
+	const size_t byteCnt = count * sizeof( T );
+	if ( ( size - offset ) < byteCnt ) {
+		return false;
+	}
+	std::memcpy( outValues, data + offset, byteCnt );
+	offset += byteCnt;
+	return true;
+}
+
+
+inline bool IsSameTileJob( const netTileJob_t& a, const netTileJob_t& b )
+{
+	return ( a.tileIx == b.tileIx ) && ( a.x0 == b.x0 ) && ( a.y0 == b.y0 ) && ( a.x1 == b.x1 ) && ( a.y1 == b.y1 ) && ( a.aovMask == b.aovMask );
+}
+
+
+// Bytes SerializeTile() writes for a tile of this shape
+inline size_t TilePayloadSize( const uint32_t width, const uint32_t height, const uint32_t aovMask )
+{
+	const size_t pixelCnt = static_cast<size_t>( width ) * height;
+	size_t size = 5 * sizeof( int32_t );
+	size += 3 * 4 * sizeof( float ) * pixelCnt;
+	size += sizeof( uint8_t ) * pixelCnt;
+	if ( aovMask != 0 ) {
+		size += AovTotalChannels * sizeof( float ) * pixelCnt;
+	}
+	return size;
+}
+
+
+// Colors are sent as float vectors so the coordinator gets exactly what
+// the worker resolved
+inline void SerializeTile( const tileBuffer_t& tile, std::vector<uint8_t>& payload )
+{
+	const int32_t header[ 5 ] = { tile.origin[ 0 ], tile.origin[ 1 ], static_cast<int32_t>( tile.width ), static_cast<int32_t>( tile.height ), static_cast<int32_t>( tile.aovMask ) };
+	AppendPod( payload, header, 5 );
+
+	const size_t pixelCnt = static_cast<size_t>( tile.width ) * tile.height;
+	const std::vector<Color>* colorPlanes[ 3 ] = { &tile.color, &tile.diffuse, &tile.normal };
+	for ( const std::vector<Color>* plane : colorPlanes )
+	{
+		for ( size_t i = 0; i < pixelCnt; ++i )
+		{
+			const vec4f c = ColorToVector( ( *plane )[ i ] );
+			const float values[ 4 ] = { c[ 0 ], c[ 1 ], c[ 2 ], c[ 3 ] };
+			AppendPod( payload, values, 4 );
+		}
+	}
+	AppendPod( payload, tile.covered.data(), pixelCnt );
+
+	if ( tile.aovMask != 0 ) {
+		AppendPod( payload, tile.aov.data(), AovTotalChannels * pixelCnt );
+	}
+}
+
+
+// Accepts only the tile that was asked for, so a worker from another build
+// or resolution cannot write outside the frame or into missing AOV planes
+inline bool DeserializeTile( const uint8_t* data, const size_t size, const netTileJob_t& job, tileBuffer_t& outTile )
+{
+	size_t offset = 0;
+	int32_t header[ 5 ];
+	if ( !ReadPod( data, size, offset, header, 5 ) ) {
+		return false;
+	}
+
+	const int32_t width = job.x1 - job.x0;
+	const int32_t height = job.y1 - job.y0;
+	if ( ( header[ 0 ] != job.x0 ) || ( header[ 1 ] != job.y0 ) || ( header[ 2 ] != width ) || ( header[ 3 ] != height ) || ( static_cast<uint32_t>( header[ 4 ] ) != job.aovMask ) ) {
+		return false;
+	}
+	if ( ( width < 0 ) || ( height < 0 ) || ( size != TilePayloadSize( width, height, job.aovMask ) ) ) {
+		return false;
+	}
+
+	BeginTile( outTile, vec2i( job.x0, job.y0 ), vec2i( job.x1, job.y1 ), job.aovMask );
+
+	const size_t pixelCnt = static_cast<size_t>( outTile.width ) * outTile.height;
+	std::vector<Color>* colorPlanes[ 3 ] = { &outTile.color, &outTile.diffuse, &outTile.normal };
+	for ( std::vector<Color>* plane : colorPlanes )
+	{
+		for ( size_t i = 0; i < pixelCnt; ++i )
+		{
+			float values[ 4 ];
+			if ( !ReadPod( data, size, offset, values, 4 ) ) {
+				return false;
+			}
+			( *plane )[ i ] = Vec4ToColor( vec4f( values[ 0 ], values[ 1 ], values[ 2 ], values[ 3 ] ) );
+		}
+	}
+	if ( !ReadPod( data, size, offset, outTile.covered.data(), pixelCnt ) ) {
+		return false;
+	}
+
+	if ( outTile.aovMask != 0 ) {
+		return ReadPod( data, size, offset, outTile.aov.data(), AovTotalChannels * pixelCnt );
+	}
+	return true;
+}
+
+
+// ============================================================
+// Worker
+// ============================================================
+
+// Serves tiles until the coordinator says it is done. The scene, view and
+// settings must match the coordinator's. Returns false if the connection
+// failed or dropped before that.
+inline bool RunRenderWorker( const char* socketPath, ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings )
+{
+	const socket_t s = ConnectUnixSocket( socketPath );
+	if ( s == InvalidSocket ) {
+		return false;
+	}
+
+	const traceTileBufferKernel_t TraceTileKernel = SelectKernel<TraceTileBufferKernels>( GetRenderFeatures( settings ) );
+
+	std::mutex sendLock;
+	std::atomic<bool> connected( true );
+
+	// Two tiles per thread so workers never wait on a round trip
+	std::vector<uint8_t> hello;
+	const netHello_t helloMsg = { 2 * pool.GetThreadCount() };
+	AppendPod( hello, &helloMsg, 1 );
+	connected = SendNetMessage( s, NET_MSG_HELLO, hello );
+
+	bool finished = false;
+	while ( connected && !finished )
+	{
+		netMsgType_t type;
+		std::vector<uint8_t> payload;
+		if ( !RecvNetMessage( s, type, payload ) ) {
+			break;
+		}
+
+		if ( type == NET_MSG_DONE )
+		{
+			finished = true;
+		}
+		else if ( ( type == NET_MSG_TILE_JOB ) && ( payload.size() == sizeof( netTileJob_t ) ) )
+		{
+			netTileJob_t job;
+			std::memcpy( &job, payload.data(), sizeof( job ) );
+
+			// A tile outside this worker's view means the two ends disagree
+			const bool inView = ( job.x0 >= 0 ) && ( job.y0 >= 0 ) && ( job.x0 <= job.x1 ) && ( job.y0 <= job.y1 ) && ( job.x1 <= view.targetSize[ 0 ] ) && ( job.y1 <= view.targetSize[ 1 ] );
+			if ( !inView ) {
+				break;
+			}
+
+			pool.Submit( [&, job]()
+			{
+				thread_local tileBuffer_t tile;
+				BeginTile( tile, vec2i( job.x0, job.y0 ), vec2i( job.x1, job.y1 ), job.aovMask );
+				TraceTileKernel( view, rtScene, settings, tile );
+
+				std::vector<uint8_t> result;
+				AppendPod( result, &job, 1 );
+				SerializeTile( tile, result );
+
+				std::lock_guard<std::mutex> guard( sendLock );
+				if ( connected && !SendNetMessage( s, NET_MSG_TILE_RESULT, result ) ) {
+					connected = false;
+				}
+			} );
+		}
+	}
+
+	pool.Wait();
+	CloseSocket( s );
+	return finished;
+}
+
+
+// ============================================================
+// Coordinator
+// ============================================================
+
+// Renders the frame on whichever workers connect to socketPath. Blocks until
+// every tile is back. Returns false if no worker has been available for
+// connectTimeoutMs, either from the start or after losing all of them.
+// outMissing then lists the tiles that never came back, for the caller to
+// trace with TraceTilesLocal(); tiles already written are left alone.
+inline bool TraceSceneDistributed( const char* socketPath, const RtView& view, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, std::vector<netTileJob_t>& outMissing, const double workerTimeoutMs, const double connectTimeoutMs )
+{
+	typedef std::chrono::steady_clock clock_t;
+
+	struct remoteWorker_t
+	{
+		socket_t				s;
+		uint32_t				maxInFlight;
+		std::vector<uint32_t>	inFlight;
+		std::vector<uint8_t>	recvBuffer;		// Bytes of messages still arriving
+		clock_t::time_point		lastHeard;
+	};
+
+	const uint32_t renderWidth = view.targetSize[ 0 ];
+	const uint32_t renderHeight = view.targetSize[ 1 ];
+	dbg.aov.Init( settings.aovMask, renderWidth, renderHeight );
+
+	// Only the raycast bit changes how a tile is written
+	const bool raycast = ( GetRenderFeatures( settings ) & RENDER_RAYCAST ) != 0;
+
+	const uint32_t tileSize = 4 * PacketWidth;
+	std::vector<netTileJob_t> jobs;
+	for ( uint32_t py = 0; py < renderHeight; py += tileSize )
+	{
+		for ( uint32_t px = 0; px < renderWidth; px += tileSize )
+		{
+			netTileJob_t job;
+			job.tileIx = static_cast<uint32_t>( jobs.size() );
+			job.x0 = px;
+			job.y0 = py;
+			job.x1 = std::min( px + tileSize, renderWidth );
+			job.y1 = std::min( py + tileSize, renderHeight );
+			job.aovMask = settings.aovMask;
+			jobs.push_back( job );
+		}
+	}
+
+	outMissing.clear();
+	const socket_t listener = ListenUnixSocket( socketPath );
+	if ( listener == InvalidSocket )
+	{
+		outMissing = jobs;
+		return false;
+	}
+
+	std::deque<uint32_t> pending;
+	for ( uint32_t i = 0; i < jobs.size(); ++i ) {
+		pending.push_back( i );
+	}
+	std::vector<uint8_t> tileDone( jobs.size(), 0 );
+	uint32_t doneCnt = 0;
+
+	std::vector<remoteWorker_t> workers;
+	tileBuffer_t tile;
+
+	auto dropWorker = [&]( const size_t workerIx )
+	{
+		// Outstanding tiles go to the front so they are picked up first
+		for ( const uint32_t tileIx : workers[ workerIx ].inFlight )
+		{
+			if ( tileDone[ tileIx ] == 0 ) {
+				pending.push_front( tileIx );
+			}
+		}
+		CloseSocket( workers[ workerIx ].s );
+		workers.erase( workers.begin() + workerIx );
+		std::cout << "Worker lost, " << pending.size() << " tiles pending" << std::endl;
+	};
+
+	auto handleMessage = [&]( remoteWorker_t& worker, const netMsgType_t type, const std::vector<uint8_t>& payload )
+	{
+		if ( ( type == NET_MSG_HELLO ) && ( payload.size() == sizeof( netHello_t ) ) )
+		{
+			netHello_t hello;
+			std::memcpy( &hello, payload.data(), sizeof( hello ) );
+			worker.maxInFlight = Clamp( hello.maxInFlight, 1u, NetMaxInFlight );
+		}
+		else if ( ( type == NET_MSG_TILE_RESULT ) && ( payload.size() > sizeof( netTileJob_t ) ) )
+		{
+			netTileJob_t job;
+			std::memcpy( &job, payload.data(), sizeof( job ) );
+
+			auto it = std::find( worker.inFlight.begin(), worker.inFlight.end(), job.tileIx );
+			const bool wasInFlight = ( it != worker.inFlight.end() );
+			if ( wasInFlight ) {
+				worker.inFlight.erase( it );
+			}
+
+			// A rejected result stays pending and is handed out again
+			const bool valid = ( job.tileIx < jobs.size() ) && IsSameTileJob( job, jobs[ job.tileIx ] ) && DeserializeTile( payload.data() + sizeof( job ), payload.size() - sizeof( job ), jobs[ job.tileIx ], tile );
+			if ( !valid && wasInFlight ) {
+				pending.push_front( job.tileIx );
+			}
+
+			if ( valid && ( tileDone[ job.tileIx ] == 0 ) )
+			{
+				if ( raycast ) {
+					WriteTile<RENDER_RAYCAST>( tile, image, dbg );
+				} else {
+					WriteTile<0>( tile, image, dbg );
+				}
+				tileDone[ job.tileIx ] = 1;
+				++doneCnt;
+			}
+		}
+	};
+
+	// Last time some worker was ready for tiles
+	clock_t::time_point lastReady = clock_t::now();
+
+	while ( doneCnt < jobs.size() )
+	{
+		// Hand out tiles up to each worker's limit
+		for ( size_t w = 0; w < workers.size(); )
+		{
+			remoteWorker_t& worker = workers[ w ];
+			bool ok = true;
+			while ( ok && !pending.empty() && ( worker.inFlight.size() < worker.maxInFlight ) )
+			{
+				const uint32_t tileIx = pending.front();
+				pending.pop_front();
+				if ( tileDone[ tileIx ] != 0 ) {
+					continue;
+				}
+
+				std::vector<uint8_t> payload;
+				AppendPod( payload, &jobs[ tileIx ], 1 );
+				worker.inFlight.push_back( tileIx );
+				ok = SendNetMessage( worker.s, NET_MSG_TILE_JOB, payload );
+			}
+
+			if ( ok ) {
+				++w;
+			} else {
+				dropWorker( w );
+			}
+		}
+
+		std::vector<pollfd> fds( workers.size() + 1 );
+		fds[ 0 ].fd = listener;
+		fds[ 0 ].events = POLLIN;
+		for ( size_t w = 0; w < workers.size(); ++w )
+		{
+			fds[ w + 1 ].fd = workers[ w ].s;
+			fds[ w + 1 ].events = POLLIN;
+		}
+
+		if ( NET_POLL( fds.data(), static_cast<uint32_t>( fds.size() ), NetPollIntervalMs ) < 0 ) {
+			break;
+		}
+
+		const clock_t::time_point now = clock_t::now();
+
+		// Walk backwards so dropping a worker leaves earlier entries in place
+		for ( size_t w = workers.size(); w-- > 0; )
+		{
+			remoteWorker_t& worker = workers[ w ];
+			if ( ( fds[ w + 1 ].revents & ( POLLIN | POLLERR | POLLHUP ) ) == 0 )
+			{
+				// Owes tiles, stopped mid-message or never said hello
+				const double quietMs = std::chrono::duration<double, std::milli>( now - worker.lastHeard ).count();
+				const bool owesData = !worker.inFlight.empty() || !worker.recvBuffer.empty() || ( worker.maxInFlight == 0 );
+				if ( owesData && ( quietMs > workerTimeoutMs ) ) {
+					dropWorker( w );
+				}
+				continue;
+			}
+
+			// Only whole messages are handled; a partial one waits in the buffer
+			const bool connected = RecvAvailable( worker.s, worker.recvBuffer );
+			worker.lastHeard = now;
+
+			netParse_t parsed;
+			netMsgType_t type;
+			std::vector<uint8_t> payload;
+			while ( ( parsed = TakeNetMessage( worker.recvBuffer, type, payload ) ) == NET_PARSE_MESSAGE ) {
+				handleMessage( worker, type, payload );
+			}
+
+			if ( !connected || ( parsed == NET_PARSE_INVALID ) ) {
+				dropWorker( w );
+			}
+		}
+
+		if ( fds[ 0 ].revents & POLLIN )
+		{
+			const socket_t s = accept( listener, nullptr, nullptr );
+			if ( ( s != InvalidSocket ) && !SetNonBlocking( s ) )
+			{
+				CloseSocket( s );
+			}
+			else if ( s != InvalidSocket )
+			{
+				// No tiles until the worker says how many it can take
+				remoteWorker_t worker;
+				worker.s = s;
+				worker.maxInFlight = 0;
+				worker.lastHeard = now;
+				workers.push_back( worker );
+			}
+		}
+
+		const bool anyReady = std::any_of( workers.begin(), workers.end(), []( const remoteWorker_t& worker ) { return worker.maxInFlight > 0; } );
+		if ( anyReady )
+		{
+			lastReady = now;
+		}
+		else if ( std::chrono::duration<double, std::milli>( now - lastReady ).count() > connectTimeoutMs )
+		{
+			std::cout << "No render workers available" << std::endl;
+			break;
+		}
+	}
+
+	for ( const remoteWorker_t& worker : workers )
+	{
+		SendNetMessage( worker.s, NET_MSG_DONE, std::vector<uint8_t>() );
+		CloseSocket( worker.s );
+	}
+	CloseSocket( listener );
+	remove( socketPath );
+
+	for ( const netTileJob_t& job : jobs )
+	{
+		if ( tileDone[ job.tileIx ] == 0 ) {
+			outMissing.push_back( job );
+		}
+	}
+	return ( doneCnt == jobs.size() );
+}
+
+
+// Traces the given tiles on the local pool. Unlike TraceScene() the passes
+// are not reset, so tiles the workers already delivered keep their values.
+inline void TraceTilesLocal( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, const std::vector<netTileJob_t>& tiles, ImageBuffer<Color>& image, debug_t& dbg )
+{
+	const tracePatchKernel_t TracePatchKernel = SelectKernel<TracePatchKernels>( GetRenderFeatures( settings ) );
+
+	for ( const netTileJob_t& job : tiles )
+	{
+		const vec2i p0 = vec2i( job.x0, job.y0 );
+		const vec2i p1 = vec2i( job.x1, job.y1 );
+		pool.Submit( [ &, p0, p1 ]() { TracePatchKernel( view, rtScene, settings, &image, &dbg, p0, p1 ); } );
+	}
+	pool.Wait();
+}
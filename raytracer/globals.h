@@ -30,17 +30,12 @@
 #include <gfxcore/math/matrix.h>
 #include "debug.h"
 
-#define USE_AABB		1
-#define USE_RELFECTION	0
-#define USE_SHADOWS		0
 #define USE_RAYTRACE	1
-#define USE_RAYCAST		0
-#define USE_SSRAND		0 // TODO: Halton sequence
+#define USE_SSRAND		0
 #define USE_SS4X		0
 #define USE_RASTERIZE	1
 #define DRAW_WIREFRAME	1
 #define	DRAW_AABB		1
-#define PHONG_NORMALS	1
 // TODO: winding order support
 
 #if 0
@@ -0,0 +1,535 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// hybrid.h — Rasterized primary visibility, ray traced shading
+//
+// Requires: raytrace.h
+//
+// Triangles are projected once and scanned over their screen bounds into a
+// visibility buffer holding the instance, triangle, barycentrics and
+// distance of the nearest surface at each pixel center. Camera rays share
+// one origin, so the tracer's triangle test collapses to three homogeneous
+// edge functions of the ray direction, set up once per triangle in world
+// space. Their ratios are the perspective-correct barycentrics and distance
+// a primary ray would have found, without any hierarchy traversal. Shading
+// then starts paths from those hits; only shadow, reflection and bounce
+// rays are traced.
+//
+// Pixel centers always reuse the buffer. Subsamples away from the center
+// fall back to a full primary trace on pixels bordering another triangle or
+// empty space, and wherever they miss the stored triangle. Triangles
+// crossing the near plane have no usable screen bounds and are tested
+// against every pixel; a frame with many of them is traced normally.
+//
+
+#include "raytrace.h"
+
+
+static const uint32_t	InvalidVisibility	= 0xFFFFFFFF;
+static const uint32_t	VisibilityBandRows	= 16;
+static const vec2f		VisibilityOffset	= vec2f( 0.5f, 0.5f );	// Sub-pixel position of the stored sample
+static const uint32_t	VisibilityMaxNearTris	= 16;	// Full screen scans allowed before tracing the frame instead
+
+
+struct visibilitySample_t
+{
+	uint32_t	instanceIx;		// InvalidVisibility where nothing was hit
+	uint32_t	triIx;			// Into the instance's model accel streams
+	float		u;
+	float		v;
+	float		t;
+};
+
+
+// Screen bounds of one projected triangle, inclusive, and its edge
+// functions. For a camera ray direction d, Dot( d, det ) is the test's
+// determinant, Dot( d, uEdge ) and Dot( d, vEdge ) the barycentrics scaled
+// by it, and tScaled / determinant the hit distance. Mirrored instances
+// have every term negated so front faces keep a positive determinant.
+struct visTriangle_t
+{
+	uint32_t	instanceIx;
+	uint32_t	triIx;
+	int32_t		x0;
+	int32_t		y0;
+	int32_t		x1;
+	int32_t		y1;
+	vec3f		det;
+	vec3f		uEdge;
+	vec3f		vEdge;
+	float		tScaled;
+};
+
+
+class VisibilityBuffer
+{
+public:
+	VisibilityBuffer() : width( 0 ), height( 0 ), complete( false ) {}
+
+	void			Init( const uint32_t width, const uint32_t height );
+
+	inline uint32_t GetWidth() const
+	{
+		return width;
+	}
+
+	inline uint32_t GetHeight() const
+	{
+		return height;
+	}
+
+	inline visibilitySample_t& Get( const uint32_t x, const uint32_t y )
+	{
+		return samples[ y * width + x ];
+	}
+
+	inline const visibilitySample_t& Get( const uint32_t x, const uint32_t y ) const
+	{
+		return samples[ y * width + x ];
+	}
+
+	// False when too many triangles crossed the near plane to scan, so the
+	// buffer was left empty
+	inline bool IsComplete() const
+	{
+		return complete;
+	}
+
+	inline void SetComplete( const bool isComplete )
+	{
+		complete = isComplete;
+	}
+
+private:
+	std::vector<visibilitySample_t>	samples;
+	uint32_t						width;
+	uint32_t						height;
+	bool							complete;
+};
+
+
+// ============================================================
+// Forward declarations
+// ============================================================
+
+bool		ProjectVisTriangle( const RtView& view, const RtInstance& instance, const vec3f* positions, visTriangle_t& outTri );
+void		SetupVisTriangle( const vec3f& eye, const RtInstance& instance, const float orientation, const vec3f* positions, visTriangle_t& outTri );
+void		RasterVisibilityBand( const RtView& view, const std::vector<visTriangle_t>& triangles, const uint32_t y0, const uint32_t y1, VisibilityBuffer& vis );
+void		RasterVisibility( ThreadPool& pool, const RtView& view, const RtScene& rtScene, VisibilityBuffer& vis );
+bool		IsSameVisSurface( const visibilitySample_t& a, const visibilitySample_t& b );
+bool		IsSilhouettePixel( const VisibilityBuffer& vis, const uint32_t x, const uint32_t y );
+bool		IntersectVisibleTriangle( const traceRay_t& ray, const RtScene& rtScene, const visibilitySample_t& visSample, hitRecord_t& outHit );
+void		PrimaryHit( const Ray& ray, const RtScene& rtScene, const VisibilityBuffer& vis, const uint32_t px, const uint32_t py, const vec2f& subPixelOffset, const bool silhouette, hitRecord_t& outHit );
+template<uint32_t Features>
+void		ShadeVisibilityTile( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, const VisibilityBuffer& vis, tileBuffer_t& tile );
+void		TraceSceneHybrid( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg );
+
+
+typedef void ( *shadeVisibilityTileKernel_t )( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, const VisibilityBuffer& vis, tileBuffer_t& tile );
+
+struct ShadeVisibilityTileKernels
+{
+	typedef shadeVisibilityTileKernel_t kernel_t;
+
+	template<uint32_t Features>
+	static void Run( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, const VisibilityBuffer& vis, tileBuffer_t& tile )
+	{
+		ShadeVisibilityTile<Features>( view, rtScene, settings, vis, tile );
+	}
+};
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline void VisibilityBuffer::Init( const uint32_t width, const uint32_t height )
+{
+	visibilitySample_t empty;
+	empty.instanceIx = InvalidVisibility;
+	empty.triIx = InvalidVisibility;
+	empty.u = 0.0f;
+	empty.v = 0.0f;
+	empty.t = FLT_MAX;
+
+	this->width = width;
+	this->height = height;
+	samples.assign( width * height, empty );
+	complete = true;
+}
+
+
+// Projects a triangle the way the raster vertex shader does. Returns false
+// if it straddles the near plane, where its screen bounds are meaningless.
+inline bool ProjectVisTriangle( const RtView& view, const RtInstance& instance, const vec3f* positions, visTriangle_t& outTri )
+{
+	AABB ssBox;
+	uint32_t behindCnt = 0;
+	for ( uint32_t i = 0; i < 3; ++i )
+	{
+		const vec4f wsPt = vec4f( TransformPoint( instance.transform, positions[ i ] ), 1.0f );
+
+		vec4f ssPt;
+		ProjectPoint( view.projView, view.targetSize, wsPt, ssPt );
+		ssBox.Expand( Trunc<4, 1>( ssPt ) );
+		behindCnt += ( ssPt[ 2 ] < -1.0f ) ? 1 : 0;
+	}
+
+	if ( behindCnt == 3 )
+	{
+		// Wholly behind the camera, covers nothing
+		outTri.x0 = outTri.y0 = 0;
+		outTri.x1 = outTri.y1 = -1;
+		return true;
+	}
+	if ( behindCnt > 0 ) {
+		return false;
+	}
+
+	// One pixel of slack absorbs the difference between the raster and
+	// camera ray pixel conventions; the ray test decides coverage. Bounds
+	// are clamped as floats so far off-screen vertices cannot overflow.
+	const float maxX = static_cast<float>( view.targetSize[ 0 ] );
+	const float maxY = static_cast<float>( view.targetSize[ 1 ] );
+	outTri.x0 = static_cast<int32_t>( Clamp( floorf( ssBox.min[ 0 ] ) - 1.0f, 0.0f, maxX ) );
+	outTri.y0 = static_cast<int32_t>( Clamp( floorf( ssBox.min[ 1 ] ) - 1.0f, 0.0f, maxY ) );
+	outTri.x1 = static_cast<int32_t>( Clamp( ceilf( ssBox.max[ 0 ] ) + 1.0f, -1.0f, maxX - 1.0f ) );
+	outTri.y1 = static_cast<int32_t>( Clamp( ceilf( ssBox.max[ 1 ] ) + 1.0f, -1.0f, maxY - 1.0f ) );
+	return true;
+}
+
+
+// Moller-Trumbore against a world space triangle with the ray origin held
+// fixed at the eye, so only terms in the ray direction are left per pixel
+inline void SetupVisTriangle( const vec3f& eye, const RtInstance& instance, const float orientation, const vec3f* positions, visTriangle_t& outTri )
+{
+	const vec3f p0 = TransformPoint( instance.transform, positions[ 0 ] );
+	const vec3f e1 = TransformPoint( instance.transform, positions[ 1 ] ) - p0;
+	const vec3f e2 = TransformPoint( instance.transform, positions[ 2 ] ) - p0;
+	const vec3f tvec = eye - p0;
+	const vec3f qvec = Cross( tvec, e1 );
+
+	outTri.det = orientation * Cross( e2, e1 );
+	outTri.uEdge = orientation * Cross( e2, tvec );
+	outTri.vEdge = orientation * qvec;
+	outTri.tScaled = orientation * Dot( e2, qvec );
+}
+
+
+// Resolves rows [ y0, y1 ) against every triangle overlapping them. Bands
+// write disjoint rows so they can run side by side.
+inline void RasterVisibilityBand( const RtView& view, const std::vector<visTriangle_t>& triangles, const uint32_t y0, const uint32_t y1, VisibilityBuffer& vis )
+{
+	const uint32_t width = vis.GetWidth();
+
+	std::vector<vec3f> pixelDirs( width * ( y1 - y0 ) );
+	for ( uint32_t y = y0; y < y1; ++y )
+	{
+		for ( uint32_t x = 0; x < width; ++x ) {
+			pixelDirs[ ( y - y0 ) * width + x ] = MakeTraceRay( GetPixelRay( view, x, y, VisibilityOffset ) ).d;
+		}
+	}
+
+	for ( const visTriangle_t& visTri : triangles )
+	{
+		const int32_t rowBegin = std::max( visTri.y0, static_cast<int32_t>( y0 ) );
+		const int32_t rowEnd = std::min( visTri.y1, static_cast<int32_t>( y1 ) - 1 );
+		if ( ( rowBegin > rowEnd ) || ( visTri.x0 > visTri.x1 ) ) {
+			continue;
+		}
+
+		for ( int32_t y = rowBegin; y <= rowEnd; ++y )
+		{
+			const vec3f* rowDirs = &pixelDirs[ ( y - y0 ) * width ];
+			for ( int32_t x = visTri.x0; x <= visTri.x1; ++x )
+			{
+				// Same acceptance as the tracer's culling test, with the
+				// stored distance doubling as the depth test
+				const vec3f& d = rowDirs[ x ];
+				const float det = Dot( d, visTri.det );
+				if ( det <= 0.0f ) {
+					continue;
+				}
+
+				const float uDet = Dot( d, visTri.uEdge );
+				const float vDet = Dot( d, visTri.vEdge );
+				if ( ( uDet < 0.0f ) || ( vDet < 0.0f ) || ( ( uDet + vDet ) > det ) ) {
+					continue;
+				}
+
+				visibilitySample_t& sample = vis.Get( x, y );
+				const float invDet = 1.0f / det;
+				const float t = visTri.tScaled * invDet;
+				if ( ( t <= MinT ) || ( t >= sample.t ) ) {
+					continue;
+				}
+
+				sample.instanceIx = visTri.instanceIx;
+				sample.triIx = visTri.triIx;
+				sample.u = uDet * invDet;
+				sample.v = vDet * invDet;
+				sample.t = t;
+			}
+		}
+	}
+}
+
+
+inline void RasterVisibility( ThreadPool& pool, const RtView& view, const RtScene& rtScene, VisibilityBuffer& vis )
+{
+	const uint32_t width = view.targetSize[ 0 ];
+	const uint32_t height = view.targetSize[ 1 ];
+	vis.Init( width, height );
+
+	// Vertex work happens once; bands only scan the screen bounds
+	const vec3f eye = MakeTraceRay( GetPixelRay( view, 0, 0, VisibilityOffset ) ).o;
+	std::vector<visTriangle_t> triangles;
+	uint32_t nearTriCnt = 0;
+	const uint32_t instanceCnt = static_cast<uint32_t>( rtScene.instances.size() );
+	for ( uint32_t instanceIx = 0; instanceIx < instanceCnt; ++instanceIx )
+	{
+		const RtInstance& instance = rtScene.instances[ instanceIx ];
+		const RtModelAccel& accel = *rtScene.modelAccels[ instance.modelIx ];
+
+		const vec3f axisX = TransformVector( instance.transform, vec3f( 1.0f, 0.0f, 0.0f ) );
+		const vec3f axisY = TransformVector( instance.transform, vec3f( 0.0f, 1.0f, 0.0f ) );
+		const vec3f axisZ = TransformVector( instance.transform, vec3f( 0.0f, 0.0f, 1.0f ) );
+		const float orientation = ( Dot( Cross( axisX, axisY ), axisZ ) < 0.0f ) ? -1.0f : 1.0f;
+
+		const uint32_t triCnt = accel.GetTriCount();
+		for ( uint32_t triIx = 0; triIx < triCnt; ++triIx )
+		{
+			visTriangle_t visTri;
+			visTri.instanceIx = instanceIx;
+			visTri.triIx = triIx;
+			vec3f pts[ 3 ];
+			accel.GetTriPositions( triIx, pts );
+			if ( !ProjectVisTriangle( view, instance, pts, visTri ) )
+			{
+				// Only the edge functions know where it lands, so give them every pixel
+				if ( ++nearTriCnt > VisibilityMaxNearTris )
+				{
+					vis.SetComplete( false );
+					return;
+				}
+				visTri.x0 = 0;
+				visTri.y0 = 0;
+				visTri.x1 = static_cast<int32_t>( width ) - 1;
+				visTri.y1 = static_cast<int32_t>( height ) - 1;
+			}
+
+			if ( ( visTri.x0 <= visTri.x1 ) && ( visTri.y0 <= visTri.y1 ) )
+			{
+				SetupVisTriangle( eye, instance, orientation, pts, visTri );
+				triangles.push_back( visTri );
+			}
+		}
+	}
+
+	for ( uint32_t y = 0; y < height; y += VisibilityBandRows )
+	{
+		const uint32_t yEnd = std::min( y + VisibilityBandRows, height );
+		pool.Submit( [&, y, yEnd]() { RasterVisibilityBand( view, triangles, y, yEnd, vis ); } );
+	}
+	pool.Wait();
+}
+
+
+inline bool IsSameVisSurface( const visibilitySample_t& a, const visibilitySample_t& b )
+{
+	return ( a.instanceIx == b.instanceIx ) && ( a.triIx == b.triIx );
+}
+
+
+// Pixels next to a different triangle or to empty space, where a sample off
+// the pixel center may see a surface the buffer does not hold. Neighbours
+// within one instance count too, since a fold of the same mesh can occlude
+// the stored triangle without leaving its bounds.
+inline bool IsSilhouettePixel( const VisibilityBuffer& vis, const uint32_t x, const uint32_t y )
+{
+	const visibilitySample_t& center = vis.Get( x, y );
+	if ( ( x > 0 ) && !IsSameVisSurface( vis.Get( x - 1, y ), center ) ) {
+		return true;
+	}
+	if ( ( ( x + 1 ) < vis.GetWidth() ) && !IsSameVisSurface( vis.Get( x + 1, y ), center ) ) {
+		return true;
+	}
+	if ( ( y > 0 ) && !IsSameVisSurface( vis.Get( x, y - 1 ), center ) ) {
+		return true;
+	}
+	if ( ( ( y + 1 ) < vis.GetHeight() ) && !IsSameVisSurface( vis.Get( x, y + 1 ), center ) ) {
+		return true;
+	}
+	return false;
+}
+
+
+inline bool IntersectVisibleTriangle( const traceRay_t& ray, const RtScene& rtScene, const visibilitySample_t& visSample, hitRecord_t& outHit )
+{
+	const RtInstance& instance = rtScene.instances[ visSample.instanceIx ];
+	uint32_t lane;
+	const triBlock_t& triBlock = rtScene.modelAccels[ instance.modelIx ]->GetTriBlock( visSample.triIx, lane );
+
+	triBlock_t block;
+	ClearTriBlock( block );
+	CopyTriBlockLane( block, 0, triBlock, lane );
+
+	triBlockHit_t hit;
+	if ( !GetTriBlockKernel()( block, ToObjectSpace( ray, instance ), true, MinT, FLT_MAX, hit ) ) {
+		return false;
+	}
+
+	outHit.t = hit.t;
+	outHit.u = hit.u;
+	outHit.v = hit.v;
+	outHit.triIx = hit.triIx;
+	outHit.instanceIx = visSample.instanceIx;
+	outHit.hitCode = hit.isBackface ? HIT_BACKFACE : HIT_FRONTFACE;
+	return true;
+}
+
+
+// Fills in what IntersectScene() would report for a camera ray, from the
+// visibility buffer where it can be trusted
+inline void PrimaryHit( const Ray& ray, const RtScene& rtScene, const VisibilityBuffer& vis, const uint32_t px, const uint32_t py, const vec2f& subPixelOffset, const bool silhouette, hitRecord_t& outHit )
+{
+	const visibilitySample_t& visSample = vis.Get( px, py );
+	const bool atCenter = ( subPixelOffset[ 0 ] == VisibilityOffset[ 0 ] ) && ( subPixelOffset[ 1 ] == VisibilityOffset[ 1 ] );
+
+	// The buffer holds the center ray's own result, silhouette or not
+	if ( atCenter || !silhouette )
+	{
+		const traceRay_t traceRay = MakeTraceRay( ray );
+		if ( visSample.instanceIx == InvalidVisibility )
+		{
+			// Open sky; only the scene bounds matter for the AABB overlay
+			float tRoot;
+			outHit.t = FLT_MAX;
+			outHit.hitCode = ( !rtScene.bvh.IsEmpty() && IntersectAABB( traceRay, rtScene.bvh.GetAABB(), FLT_MAX, tRoot ) ) ? HIT_AABB : HIT_NONE;
+			return;
+		}
+
+		if ( atCenter )
+		{
+			// Camera rays cull backfaces, so it is always a front face
+			outHit.t = visSample.t;
+			outHit.u = visSample.u;
+			outHit.v = visSample.v;
+			outHit.triIx = visSample.triIx;
+			outHit.instanceIx = visSample.instanceIx;
+			outHit.hitCode = HIT_FRONTFACE;
+			return;
+		}
+
+		if ( IntersectVisibleTriangle( traceRay, rtScene, visSample, outHit ) ) {
+			return;
+		}
+	}
+
+	IntersectScene( ray, rtScene, true, false, outHit );
+}
+
+
+template<uint32_t Features>
+inline void ShadeVisibilityTile( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, const VisibilityBuffer& vis, tileBuffer_t& tile )
+{
+	const uint32_t x0 = tile.origin[ 0 ];
+	const uint32_t y0 = tile.origin[ 1 ];
+	const uint32_t xEnd = x0 + tile.width;
+	const uint32_t yEnd = y0 + tile.height;
+
+	for ( uint32_t py = y0; py < yEnd; ++py )
+	{
+		for ( uint32_t px = x0; px < xEnd; ++px )
+		{
+			const bool silhouette = IsSilhouettePixel( vis, px, py );
+
+			pixelAccum_t accum;
+			ClearAccum( accum );
+
+			Sampler sampler( SamplerSeed, px, py );
+			for ( uint32_t s = 0; s < SubSampleCnt; ++s ) // Subsamples
+			{
+				sampler.StartSample( s );
+				const vec2f subPixelOffset = SubPixelOffset( sampler );
+				const Ray ray = GetPixelRay( view, px, py, subPixelOffset );
+
+				hitRecord_t hit;
+				PrimaryHit( ray, rtScene, vis, px, py, subPixelOffset, silhouette, hit );
+
+				const sample_t sample = TracePath<Features>( ray, hit, rtScene, settings, sampler );
+				AccumulateSample( accum, sample );
+			}
+
+			ResolvePixel( tile, px, py, accum );
+		}
+	}
+}
+
+
+inline void TraceSceneHybrid( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg )
+{
+	const uint32_t renderWidth = view.targetSize[ 0 ];
+	const uint32_t renderHeight = view.targetSize[ 1 ];
+
+	VisibilityBuffer vis;
+	RasterVisibility( pool, view, rtScene, vis );
+	if ( !vis.IsComplete() )
+	{
+		TraceScene( pool, view, rtScene, settings, image, dbg );
+		return;
+	}
+
+	dbg.aov.Init( settings.aovMask, renderWidth, renderHeight );
+
+	const uint32_t features = GetRenderFeatures( settings );
+	const shadeVisibilityTileKernel_t ShadeTileKernel = SelectKernel<ShadeVisibilityTileKernels>( features );
+	const bool raycast = ( features & RENDER_RAYCAST ) != 0;
+
+	const uint32_t tileSize = 4 * PacketWidth;
+	for ( uint32_t py = 0; py < renderHeight; py += tileSize )
+	{
+		for ( uint32_t px = 0; px < renderWidth; px += tileSize )
+		{
+			const vec2i p0 = vec2i( px, py );
+			const vec2i p1 = vec2i( std::min( px + tileSize, renderWidth ), std::min( py + tileSize, renderHeight ) );
+
+			pool.Submit( [ &, p0, p1 ]()
+			{
+				thread_local tileBuffer_t tile;
+				BeginTile( tile, p0, p1, dbg.aov.GetPassMask() );
+				ShadeTileKernel( view, rtScene, settings, vis, tile );
+
+				if ( raycast ) {
+					WriteTile<RENDER_RAYCAST>( tile, image, dbg );
+				} else {
+					WriteTile<0>( tile, image, dbg );
+				}
+			} );
+		}
+	}
+	pool.Wait();
+}
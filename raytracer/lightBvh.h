@@ -0,0 +1,218 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// lightBvh.h — Light hierarchy for many-light sampling
+//
+// Requires: bvh.h, GfxCore light_t
+//
+// Binary tree over the scene's point lights, one light per leaf, laid out
+// like Bvh: the first child follows its parent, the second is referenced by
+// offset. Each node bounds the positions and sums the power of the lights
+// below it. Sampling walks from the root and picks a child in proportion to
+// an estimate of its contribution at the shading point, so one draw costs
+// O(log n) node visits.
+//
+
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <cstdint>
+#include <cmath>
+
+
+// Lower bound on the cosine term, so lights that can only reach the surface
+// through the specular lobe keep a nonzero probability
+static const float		LightBvhMinCos	= 0.05f;
+
+
+struct lightBvhNode_t
+{
+	AABB		bounds;
+	float		power;
+	uint32_t	offset;		// Leaf: index into RtScene::lights, Interior: second child
+	uint32_t	lightCnt;	// One for leaves
+};
+
+
+class LightBvh
+{
+public:
+	std::vector<lightBvhNode_t>	nodes;
+
+	void			Build( const std::vector<light_t>& lights );
+	bool			Sample( const vec3f& pt, const vec3f& normal, float u, uint32_t& outLightIx, float& outPmf ) const;
+
+	inline bool IsEmpty() const
+	{
+		return nodes.empty();
+	}
+
+private:
+	uint32_t		BuildRecursive( const std::vector<light_t>& lights, std::vector<uint32_t>& lightIndices, const uint32_t first, const uint32_t count );
+};
+
+
+// ============================================================
+// Utility
+// ============================================================
+
+inline float LightPower( const light_t& light )
+{
+	const vec4f c = light.intensity * ColorToVector( light.color );
+	return std::max( 0.0f, 0.2126f * c[ 0 ] + 0.7152f * c[ 1 ] + 0.0722f * c[ 2 ] );
+}
+
+
+// Estimated contribution of the lights under a node. Point lights emit in
+// every direction, so orientation only bounds the receiver: the smallest
+// angle between the surface normal and any point in the node's bounds.
+inline float LightNodeImportance( const lightBvhNode_t& node, const vec3f& pt, const vec3f& normal )
+{
+	const vec3f toCenter = Centroid( node.bounds ) - pt;
+	const vec3f halfExtent = 0.5f * ( node.bounds.max - node.bounds.min );
+	const float radius2 = Dot( halfExtent, halfExtent );
+	const float dist2 = Dot( toCenter, toCenter );
+
+	float cosBound = 1.0f;
+	if ( dist2 > radius2 )
+	{
+		const float dist = sqrt( dist2 );
+		const float sinB = sqrt( radius2 / dist2 );
+		const float cosB = sqrt( std::max( 0.0f, 1.0f - sinB * sinB ) );
+		const float cosI = std::min( 1.0f, std::abs( Dot( normal, toCenter ) ) / dist );
+		const float sinI = sqrt( std::max( 0.0f, 1.0f - cosI * cosI ) );
+
+		// cos( max( 0, thetaI - thetaB ) )
+		cosBound = ( cosI >= cosB ) ? 1.0f : ( cosI * cosB + sinI * sinB );
+	}
+
+	return node.power * std::max( cosBound, LightBvhMinCos ) / std::max( std::max( dist2, radius2 ), 1e-6f );
+}
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline void LightBvh::Build( const std::vector<light_t>& lights )
+{
+	nodes.clear();
+
+	const uint32_t lightCnt = static_cast<uint32_t>( lights.size() );
+	if ( lightCnt == 0 ) {
+		return;
+	}
+
+	std::vector<uint32_t> lightIndices( lightCnt );
+	std::iota( lightIndices.begin(), lightIndices.end(), 0 );
+
+	nodes.reserve( 2 * lightCnt - 1 );
+	BuildRecursive( lights, lightIndices, 0, lightCnt );
+}
+
+
+inline uint32_t LightBvh::BuildRecursive( const std::vector<light_t>& lights, std::vector<uint32_t>& lightIndices, const uint32_t first, const uint32_t count )
+{
+	const uint32_t nodeIx = static_cast<uint32_t>( nodes.size() );
+	nodes.push_back( lightBvhNode_t() );
+
+	lightBvhNode_t node;
+	node.power = 0.0f;
+	node.lightCnt = count;
+	for ( uint32_t i = first; i < first + count; ++i )
+	{
+		const light_t& light = lights[ lightIndices[ i ] ];
+		node.bounds.Expand( Trunc<4, 1>( light.pos ) );
+		node.power += LightPower( light );
+	}
+
+	if ( count == 1 )
+	{
+		node.offset = lightIndices[ first ];
+		nodes[ nodeIx ] = node;
+		return nodeIx;
+	}
+
+	// Median split keeps the tree balanced, so every draw is O(log n)
+	const vec3f extent = node.bounds.max - node.bounds.min;
+	uint32_t axis = 0;
+	if ( extent[ 1 ] > extent[ axis ] ) {
+		axis = 1;
+	}
+	if ( extent[ 2 ] > extent[ axis ] ) {
+		axis = 2;
+	}
+
+	const uint32_t leftCnt = count / 2;
+	std::nth_element( lightIndices.begin() + first, lightIndices.begin() + first + leftCnt, lightIndices.begin() + first + count,
+		[&]( const uint32_t a, const uint32_t b ) { return lights[ a ].pos[ axis ] < lights[ b ].pos[ axis ]; } );
+
+	BuildRecursive( lights, lightIndices, first, leftCnt );
+	node.offset = BuildRecursive( lights, lightIndices, first + leftCnt, count - leftCnt );
+
+	nodes[ nodeIx ] = node;
+	return nodeIx;
+}
+
+
+inline bool LightBvh::Sample( const vec3f& pt, const vec3f& normal, float u, uint32_t& outLightIx, float& outPmf ) const
+{
+	if ( nodes.empty() ) {
+		return false;
+	}
+
+	float pmf = 1.0f;
+	uint32_t nodeIx = 0;
+	while ( nodes[ nodeIx ].lightCnt > 1 )
+	{
+		const uint32_t child0 = nodeIx + 1;
+		const uint32_t child1 = nodes[ nodeIx ].offset;
+		const float importance0 = LightNodeImportance( nodes[ child0 ], pt, normal );
+		const float importance1 = LightNodeImportance( nodes[ child1 ], pt, normal );
+		if ( ( importance0 + importance1 ) <= 0.0f ) {
+			return false;
+		}
+
+		// The uniform number is rescaled and reused at every level
+		const float p0 = importance0 / ( importance0 + importance1 );
+		if ( u < p0 )
+		{
+			nodeIx = child0;
+			pmf *= p0;
+			u = std::min( u / p0, 0.99999994f );
+		}
+		else
+		{
+			nodeIx = child1;
+			pmf *= ( 1.0f - p0 );
+			u = std::min( ( u - p0 ) / ( 1.0f - p0 ), 0.99999994f );
+		}
+	}
+
+	outLightIx = nodes[ nodeIx ].offset;
+	outPmf = pmf;
+	return ( pmf > 0.0f );
+}
@@ -32,7 +32,7 @@
 #include <cstdint>
 #include <tuple>
 #include <map>
-#include <thread>
+#include <cstring>
 #include <gfxcore/image/bitmap.h>
 #include <gfxcore/image/color.h>
 #include <gfxcore/math/vector.h>
@@ -51,6 +51,12 @@
 #include "debug.h"
 #include "globals.h"
 #include "raytrace.h"
+#include "wavefront.h"
+#include "progressive.h"
+#include "renderJob.h"
+#include "distributed.h"
+#include "denoise.h"
+#include "hybrid.h"
 
 ResourceManager	rm;
 
@@ -65,7 +71,7 @@ ImageBuffer<float>	depthBuffer;
 
 extern ImageBuffer<float> zBuffer;
 
-void RasterScene( ImageBuffer<Color>& image, const RtView& view, bool wireFrame = true );
+void RasterScene( ImageBuffer<Color>& image, const RtView& view, const RtScene& rtScene, bool wireFrame = true );
 
 void ImageToBitmap( const ImageBuffer<Color>& image, Bitmap& bitmap );
 void ImageToBitmap( const ImageBuffer<float>& image, Bitmap& bitmap );
@@ -149,17 +155,20 @@ void SetupViews()
 }
 
 
-void RasterizeViews( RtScene& rtScene )
+void RasterizeViews( ThreadPool& pool, const RtScene& rtScene )
 {
+	// Each view writes its own target, so the passes can run side by side
 #if USE_RASTERIZE
-	RasterScene( colorBuffer, rtViews[ VIEW_FRONT ], rtScene, false );
+	pool.Submit( [&]() { RasterScene( colorBuffer, rtViews[ VIEW_FRONT ], rtScene, false ); } );
 #endif
 
 #if DRAW_WIREFRAME
-	RasterScene( dbg.wireframe, rtViews[ VIEW_FRONT ], rtScene );
-	RasterScene( dbg.topWire, rtViews[ VIEW_TOP ], rtScene );
-	RasterScene( dbg.sideWire, rtViews[ VIEW_SIDE ], rtScene );
+	pool.Submit( [&]() { RasterScene( dbg.wireframe, rtViews[ VIEW_FRONT ], rtScene ); } );
+	pool.Submit( [&]() { RasterScene( dbg.topWire, rtViews[ VIEW_TOP ], rtScene ); } );
+	pool.Submit( [&]() { RasterScene( dbg.sideWire, rtViews[ VIEW_SIDE ], rtScene ); } );
 #endif
+
+	pool.Wait();
 }
 
 
@@ -240,7 +249,43 @@ void CreateMaterials( AssetManager& assets )
 }
 
 
-void BuildRtSceneView( AssetManager& assets, RtScene& rtScene )
+// An entity placed in the trace scene, and the transform its instance
+// was last given
+struct sceneEntity_t
+{
+	Entity		ent;
+	uint32_t	instanceIx;
+	mat4x4f		instanceTransform;
+};
+
+
+void AddSceneEntity( AssetManager& assets, RtScene& rtScene, const Entity& ent, std::vector<sceneEntity_t>& entities )
+{
+	sceneEntity_t sceneEnt;
+	sceneEnt.ent = ent;
+	sceneEnt.instanceIx = AddInstance( assets, rtScene, ent );
+	sceneEnt.instanceTransform = ent.GetMatrix();
+	entities.push_back( sceneEnt );
+}
+
+
+// Pushes the transforms of entities that moved since the last commit, so
+// the commit refits the scene hierarchy instead of rebuilding it
+void SyncInstanceTransforms( RtSceneBuilder& sceneBuilder, std::vector<sceneEntity_t>& entities )
+{
+	for ( sceneEntity_t& sceneEnt : entities )
+	{
+		const mat4x4f transform = sceneEnt.ent.GetMatrix();
+		if ( memcmp( &transform, &sceneEnt.instanceTransform, sizeof( mat4x4f ) ) != 0 )
+		{
+			sceneBuilder.SetInstanceTransform( sceneEnt.instanceIx, transform );
+			sceneEnt.instanceTransform = transform;
+		}
+	}
+}
+
+
+void BuildRtSceneView( AssetManager& assets, RtScene& rtScene, std::vector<sceneEntity_t>& entities )
 {
 	hdl_t modelHdl;
 	Model model;
@@ -256,9 +301,7 @@ void BuildRtSceneView( AssetManager& assets, RtScene& rtScene )
 			ent.SetRotation( vec3f( 0.0f, 0.0f, 180.0f ) );
 			ent.SetOrigin( vec3f( 0.0f, -70.0f, 0.0f ) );		
 			
-			RtModel sphere;
-			CreateRayTraceModel( assets, &ent, &sphere );
-			rtScene.models.push_back( sphere );
+			AddSceneEntity( assets, rtScene, ent, entities );
 		}
 		/*
 		{
@@ -268,9 +311,7 @@ void BuildRtSceneView( AssetManager& assets, RtScene& rtScene )
 			ent.SetRotation( vec3f( 0.0f, 0.0f, 0.0f ) );
 			ent.SetOrigin( vec3f( 30.0f, -20.0f, 0.0f ) );
 
-			RtModel sphere;
-			CreateRayTraceModel( scene, &ent, &sphere );
-			rtScene.models.push_back( sphere );
+			AddSceneEntity( assets, rtScene, ent, entities );
 		}
 
 		{
@@ -280,9 +321,7 @@ void BuildRtSceneView( AssetManager& assets, RtScene& rtScene )
 			ent.SetRotation( vec3f( 0.0f, 0.0f, 0.0f ) );
 			ent.SetOrigin( vec3f( 30.0f, 30.0f, 0.0f ) );
 			
-			RtModel sphere;
-			CreateRayTraceModel( scene, &ent, &sphere );
-			rtScene.models.push_back( sphere );
+			AddSceneEntity( assets, rtScene, ent, entities );
 		}
 
 		{
@@ -292,9 +331,7 @@ void BuildRtSceneView( AssetManager& assets, RtScene& rtScene )
 			ent.SetRotation( vec3f( 0.0f, 0.0f, 0.0f ) );
 			ent.SetOrigin( vec3f( 30.0f, 80.0f, 0.0f ) );
 			
-			RtModel sphere;
-			CreateRayTraceModel( scene, &ent, &sphere );
-			rtScene.models.push_back( sphere );
+			AddSceneEntity( assets, rtScene, ent, entities );
 		}
 		*/
 	}
@@ -316,14 +353,6 @@ void BuildRtSceneView( AssetManager& assets, RtScene& rtScene )
 		rtScene.lights.push_back( l );
 		*/
 	}
-
-	const size_t modelCnt = rtScene.models.size();
-	for ( size_t m = 0; m < modelCnt; ++m )
-	{
-		RtModel& model = rtScene.models[ m ];
-		rtScene.aabb.Expand( model.octree.GetAABB().min );
-		rtScene.aabb.Expand( model.octree.GetAABB().max );
-	}
 }
 
 
@@ -377,15 +406,18 @@ int raytracemain(void)
 
 	Timer loadTimer;
 	Scene scene;
-	RtScene rtScene;
-
-	rtScene.scene = &scene;
+	RtSceneBuilder sceneBuilder;
+	std::vector<sceneEntity_t> entities;
+	{
+		RtScene& rtScene = sceneBuilder.Edit();
+		rtScene.scene = &scene;
 
-	CreateMaterials( *rtScene.assets );
+		CreateMaterials( *rtScene.assets );
 
-	loadTimer.Start();
-	BuildRtSceneView( *rtScene.assets, rtScene );
-	loadTimer.Stop();
+		loadTimer.Start();
+		BuildRtSceneView( *rtScene.assets, rtScene, entities );
+		loadTimer.Stop();
+	}
 
 	std::cout << "Load Time: " << loadTimer.GetElapsed() << "ms" << std::endl;
 
@@ -403,16 +435,56 @@ int raytracemain(void)
 
 	SetupViews();
 
+	// Workers persist across frames rather than being spawned per trace
+	ThreadPool pool;
+
+	const renderSettings_t renderSettings = FinalRenderSettings();
+
 	const int32_t imageCnt = 1;
 	for ( int32_t i = 0; i < imageCnt; ++i )
 	{
 		Timer traceTimer;
 
+		// Workers reference one frozen snapshot for the whole frame
+		SyncInstanceTransforms( sceneBuilder, entities );
+		const RtSceneRef rtScene = sceneBuilder.Commit();
+
 		traceTimer.Start();
-		TraceScene( rtViews[ VIEW_CAMERA ], rtScene, frameBuffer );
+#if USE_ADAPTIVE
+		TraceSceneProgressive( pool, rtViews[ VIEW_CAMERA ], *rtScene, renderSettings, DefaultSamplingSettings(), frameBuffer, dbg );
+#elif USE_WAVEFRONT
+		TraceSceneWavefront( pool, rtViews[ VIEW_CAMERA ], *rtScene, renderSettings, frameBuffer, dbg );
+#elif USE_HYBRID
+		TraceSceneHybrid( pool, rtViews[ VIEW_CAMERA ], *rtScene, renderSettings, frameBuffer, dbg );
+#elif USE_DISTRIBUTED
+		// Tiles are traced by raytraceworkermain() processes on the same socket
+		std::vector<netTileJob_t> missingTiles;
+		if ( !TraceSceneDistributed( RenderSocketPath, rtViews[ VIEW_CAMERA ], renderSettings, frameBuffer, dbg, missingTiles ) )
+		{
+			std::cout << "Distributed trace incomplete, tracing " << missingTiles.size() << " tiles locally" << std::endl;
+			TraceTilesLocal( pool, rtViews[ VIEW_CAMERA ], *rtScene, renderSettings, missingTiles, frameBuffer, dbg );
+		}
+#else
+		RenderJob job( pool );
+		job.Start( rtViews[ VIEW_CAMERA ], rtScene, renderSettings, frameBuffer, dbg );
+
+		renderProgress_t progress = job.Poll();
+		while ( progress.state == JOB_RUNNING )
+		{
+			std::this_thread::sleep_for( std::chrono::milliseconds( 100 ) );
+			progress = job.Poll();
+			std::cout << "\r" << progress.finalTiles << "/" << progress.tileCnt << " tiles" << std::flush;
+		}
+#endif
+#if USE_ADAPTIVE || USE_WAVEFRONT || USE_HYBRID || USE_DISTRIBUTED
+		// RenderJob filters as its last step, the blocking paths do it here
+		if ( renderSettings.denoise ) {
+			DenoiseImage( pool, frameBuffer, dbg.aov, DefaultDenoiseSettings() );
+		}
+#endif
 		traceTimer.Stop();
 
-		RasterizeViews( rtScene );
+		RasterizeViews( pool, *rtScene );
 
 		std::cout << "\n\nTrace Time: " << traceTimer.GetElapsed() << "ms" << std::endl;
 
@@ -433,4 +505,39 @@ int raytracemain(void)
 
 	std::cout << "Raytrace Finished." << std::endl;
 	return 1;
-}
\ No newline at end of file
+}
+
+
+// Serves tiles for a coordinator built with USE_DISTRIBUTED. Builds the same
+// scene and views so only tile jobs and results go over the socket.
+int raytraceworkermain( const char* socketPath )
+{
+	std::cout << "Running Raytrace Worker" << std::endl;
+
+	Scene scene;
+	RtSceneBuilder sceneBuilder;
+	std::vector<sceneEntity_t> entities;
+	{
+		RtScene& rtScene = sceneBuilder.Edit();
+		rtScene.scene = &scene;
+
+		CreateMaterials( *rtScene.assets );
+		BuildRtSceneView( *rtScene.assets, rtScene, entities );
+	}
+
+	SetupViews();
+
+	ThreadPool pool;
+
+	const renderSettings_t renderSettings = FinalRenderSettings();
+	const RtSceneRef rtScene = sceneBuilder.Commit();
+
+	if ( !RunRenderWorker( ( socketPath != nullptr ) ? socketPath : RenderSocketPath, pool, rtViews[ VIEW_CAMERA ], *rtScene, renderSettings ) )
+	{
+		std::cout << "Worker disconnected." << std::endl;
+		return 0;
+	}
+
+	std::cout << "Raytrace Worker Finished." << std::endl;
+	return 1;
+}
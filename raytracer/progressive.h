@@ -0,0 +1,252 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// progressive.h — Variance-driven adaptive sampling
+//
+// Requires: raytrace.h
+//
+// Renders in passes. Each pass adds a few samples to every pixel that has
+// not converged yet, tracking a running mean and variance of luminance.
+// A pixel stops once the standard error of its mean drops below the
+// threshold; the frame stops when all pixels have converged or a sample
+// or time budget runs out. Budgets are checked between passes, and the
+// first pass always gives every pixel its minimum sample count.
+//
+
+#include "raytrace.h"
+#include <chrono>
+
+
+struct samplingSettings_t
+{
+	uint32_t	minSamples;			// Taken by every pixel before the error test
+	uint32_t	maxSamples;
+	uint32_t	samplesPerPass;
+	float		errorThreshold;		// Standard error relative to the pixel mean
+	uint64_t	sampleBudget;		// Whole frame, 0 for no limit. Checked between passes after minSamples
+	double		timeBudgetMs;		// 0 for no limit
+};
+
+
+// Pixel brightness below which the error test stops being relative
+static const float		AdaptiveLumFloor	= 0.05f;
+
+
+// Running statistics of one pixel
+struct pixelStats_t
+{
+	pixelAccum_t	accum;
+	float			lumMean;
+	float			lumM2;		// Sum of squared deviations (Welford)
+	bool			converged;
+};
+
+
+// ============================================================
+// Forward declarations
+// ============================================================
+
+samplingSettings_t	DefaultSamplingSettings();
+float		Luminance( const Color& color );
+void		AddPixelSample( pixelStats_t& stats, const sample_t& sample );
+bool		IsPixelConverged( const pixelStats_t& stats, const samplingSettings_t& settings );
+template<uint32_t Features>
+uint32_t	RefineTile( const RtView& view, const RtScene& rtScene, const renderSettings_t& renderSettings, const samplingSettings_t& settings, std::vector<pixelStats_t>& stats, const vec2i& p0, const vec2i& p1, const uint32_t passSamples, std::atomic<uint64_t>& samplesTaken );
+void		TraceSceneProgressive( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& renderSettings, const samplingSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg );
+
+
+typedef uint32_t ( *refineTileKernel_t )( const RtView& view, const RtScene& rtScene, const renderSettings_t& renderSettings, const samplingSettings_t& settings, std::vector<pixelStats_t>& stats, const vec2i& p0, const vec2i& p1, const uint32_t passSamples, std::atomic<uint64_t>& samplesTaken );
+
+struct RefineTileKernels
+{
+	typedef refineTileKernel_t kernel_t;
+
+	template<uint32_t Features>
+	static uint32_t Run( const RtView& view, const RtScene& rtScene, const renderSettings_t& renderSettings, const samplingSettings_t& settings, std::vector<pixelStats_t>& stats, const vec2i& p0, const vec2i& p1, const uint32_t passSamples, std::atomic<uint64_t>& samplesTaken )
+	{
+		return RefineTile<Features>( view, rtScene, renderSettings, settings, stats, p0, p1, passSamples, samplesTaken );
+	}
+};
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline samplingSettings_t DefaultSamplingSettings()
+{
+	samplingSettings_t settings;
+	settings.minSamples = 4;
+	settings.maxSamples = 256;
+	settings.samplesPerPass = 4;
+	settings.errorThreshold = 0.01f;
+	settings.sampleBudget = 0;
+	settings.timeBudgetMs = 0.0;
+	return settings;
+}
+
+
+inline float Luminance( const Color& color )
+{
+	const vec4f c = ColorToVector( color );
+	return 0.2126f * c[ 0 ] + 0.7152f * c[ 1 ] + 0.0722f * c[ 2 ];
+}
+
+
+inline void AddPixelSample( pixelStats_t& stats, const sample_t& sample )
+{
+	AccumulateSample( stats.accum, sample );
+
+	const float lum = Luminance( sample.color );
+	const float delta = lum - stats.lumMean;
+	stats.lumMean += delta / stats.accum.sampleCnt;
+	stats.lumM2 += delta * ( lum - stats.lumMean );
+}
+
+
+inline bool IsPixelConverged( const pixelStats_t& stats, const samplingSettings_t& settings )
+{
+	const uint32_t n = stats.accum.sampleCnt;
+	if ( n < std::max( settings.minSamples, 2u ) ) {
+		return false;
+	}
+	if ( n >= settings.maxSamples ) {
+		return true;
+	}
+
+	const float variance = stats.lumM2 / ( n - 1 );
+	const float stdError = sqrt( variance / n );
+	return ( stdError <= settings.errorThreshold * std::max( stats.lumMean, AdaptiveLumFloor ) );
+}
+
+
+// Adds up to passSamples to each unconverged pixel of the tile. Returns how
+// many pixels still need more samples afterwards.
+template<uint32_t Features>
+inline uint32_t RefineTile( const RtView& view, const RtScene& rtScene, const renderSettings_t& renderSettings, const samplingSettings_t& settings, std::vector<pixelStats_t>& stats, const vec2i& p0, const vec2i& p1, const uint32_t passSamples, std::atomic<uint64_t>& samplesTaken )
+{
+	const uint32_t imageWidth = view.targetSize[ 0 ];
+
+	uint32_t activeCnt = 0;
+	for ( uint32_t py = p0[ 1 ]; py < static_cast<uint32_t>( p1[ 1 ] ); ++py )
+	{
+		for ( uint32_t px = p0[ 0 ]; px < static_cast<uint32_t>( p1[ 0 ] ); ++px )
+		{
+			pixelStats_t& pixel = stats[ py * imageWidth + px ];
+			if ( pixel.converged ) {
+				continue;
+			}
+
+			const uint32_t sampleCnt = std::min( passSamples, settings.maxSamples - pixel.accum.sampleCnt );
+
+			// Sample indices continue across passes so the sequence stays stratified
+			Sampler sampler( SamplerSeed, px, py );
+			for ( uint32_t s = 0; s < sampleCnt; ++s )
+			{
+				sampler.StartSample( pixel.accum.sampleCnt );
+				const Ray ray = GetPixelRay( view, px, py, sampler.Next2D() );
+				AddPixelSample( pixel, RayTrace<Features>( ray, rtScene, renderSettings, sampler ) );
+			}
+			samplesTaken += sampleCnt;
+
+			pixel.converged = IsPixelConverged( pixel, settings );
+			activeCnt += pixel.converged ? 0 : 1;
+		}
+	}
+	return activeCnt;
+}
+
+
+inline void TraceSceneProgressive( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& renderSettings, const samplingSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg )
+{
+#if USE_RAYTRACE
+	const uint32_t features = GetRenderFeatures( renderSettings );
+	const refineTileKernel_t RefineTileKernel = SelectKernel<RefineTileKernels>( features );
+
+	typedef std::chrono::steady_clock clock_t;
+	const clock_t::time_point startTime = clock_t::now();
+
+	const uint32_t renderWidth = view.targetSize[ 0 ];
+	const uint32_t renderHeight = view.targetSize[ 1 ];
+	dbg.aov.Init( renderSettings.aovMask, renderWidth, renderHeight );
+	const uint32_t tileSize = 4 * PacketWidth;
+
+	std::vector<pixelStats_t> stats( renderWidth * renderHeight );
+	for ( pixelStats_t& pixel : stats )
+	{
+		pixel = {};
+		ClearAccum( pixel.accum );
+	}
+
+	std::atomic<uint64_t> samplesTaken( 0 );
+
+	uint32_t passSamples = std::max( 1u, settings.minSamples );
+	for ( uint32_t pass = 0; ; ++pass )
+	{
+		std::atomic<uint32_t> activeCnt( 0 );
+		for ( uint32_t py = 0; py < renderHeight; py += tileSize )
+		{
+			for ( uint32_t px = 0; px < renderWidth; px += tileSize )
+			{
+				const vec2i p0 = vec2i( px, py );
+				const vec2i p1 = vec2i( Clamp( px + tileSize, px, renderWidth ), Clamp( py + tileSize, py, renderHeight ) );
+
+				pool.Submit( [ &, p0, p1 ]()
+				{
+					activeCnt += RefineTileKernel( view, rtScene, renderSettings, settings, stats, p0, p1, passSamples, samplesTaken );
+				} );
+			}
+		}
+		pool.Wait();
+
+		const double elapsedMs = std::chrono::duration<double, std::milli>( clock_t::now() - startTime ).count();
+		std::cout << "Pass " << pass << ": " << activeCnt << " active pixels, " << elapsedMs << "ms" << std::endl;
+
+		const bool outOfSamples = ( settings.sampleBudget > 0 ) && ( samplesTaken >= settings.sampleBudget );
+		const bool outOfTime = ( settings.timeBudgetMs > 0.0 ) && ( elapsedMs >= settings.timeBudgetMs );
+		if ( ( activeCnt == 0 ) || outOfSamples || outOfTime ) {
+			break;
+		}
+		passSamples = std::max( 1u, settings.samplesPerPass );
+	}
+
+	tileBuffer_t frame;
+	BeginTile( frame, vec2i( 0, 0 ), vec2i( renderWidth, renderHeight ), dbg.aov.GetPassMask() );
+	for ( uint32_t py = 0; py < renderHeight; ++py )
+	{
+		for ( uint32_t px = 0; px < renderWidth; ++px ) {
+			ResolvePixel( frame, px, py, stats[ py * renderWidth + px ].accum );
+		}
+	}
+
+	// Only the raycast bit changes how a tile is written
+	if ( features & RENDER_RAYCAST ) {
+		WriteTile<RENDER_RAYCAST>( frame, image, dbg );
+	} else {
+		WriteTile<0>( frame, image, dbg );
+	}
+#endif
+}
@@ -30,7 +30,7 @@
 //
 // Contains vertex/fragment types, debug drawing helpers (cubes,
 // axes, points, rays, octrees), a vertex shader, scanline
-// rasterizer with z-buffer and Blinn-Phong/GGX shading, and
+// rasterizer with z-buffer and textured GGX shading, and
 // wireframe rendering.
 //
 
@@ -75,7 +75,7 @@ void DrawRay( ImageBuffer<Color>& image, const RtView& view, const Ray& ray, con
 template<typename T>
 void DrawOctree( ImageBuffer<Color>& image, const RtView& view, const Octree<T>& octree, const Color& color );
 
-bool VertexShader( const RtView& view, const Triangle& tri, vertexOut_t& outVertex );
+bool VertexShader( const RtView& view, const RtInstance& instance, const RtModelAccel& accel, const uint32_t triIx, vertexOut_t& outVertex );
 bool EmitFragment( const vec3f& baryPt, const vertexOut_t& vo, fragmentInput_t& outFragment );
 bool PixelShader( const fragmentInput_t& frag );
 void RasterScene( ImageBuffer<Color>& image, const RtView& view, const RtScene& rtScene, bool wireFrame = true );
@@ -221,44 +221,37 @@ inline void DrawOctree( ImageBuffer<Color>& image, const RtView& view, const Oct
 }
 
 
-inline bool VertexShader( const RtView& view, const Triangle& tri, vertexOut_t& outVertex )
+inline bool VertexShader( const RtView& view, const RtInstance& instance, const RtModelAccel& accel, const uint32_t triIx, vertexOut_t& outVertex )
 {
 	const mat4x4f& mvp = view.projView;
+	vec3f pts[ 3 ];
+	accel.GetTriPositions( triIx, pts );
+	const triAttrib_t& attrib = accel.attribs[ triIx ];
 
-	const vec4f* wsPts[ 3 ];
+	vec4f wsPts[ 3 ];
 	vec4f ssPts[ 3 ];
 	bool culled = false;
 
-	wsPts[ 0 ] = &tri.v0.pos;
-	wsPts[ 1 ] = &tri.v1.pos;
-	wsPts[ 2 ] = &tri.v2.pos;
+	wsPts[ 0 ] = vec4f( TransformPoint( instance.transform, pts[ 0 ] ), 1.0 );
+	wsPts[ 1 ] = vec4f( TransformPoint( instance.transform, pts[ 1 ] ), 1.0 );
+	wsPts[ 2 ] = vec4f( TransformPoint( instance.transform, pts[ 2 ] ), 1.0 );
 
-	ProjectPoint( mvp, view.targetSize, *wsPts[ 0 ], ssPts[ 0 ] );
-	ProjectPoint( mvp, view.targetSize, *wsPts[ 1 ], ssPts[ 1 ] );
-	ProjectPoint( mvp, view.targetSize, *wsPts[ 2 ], ssPts[ 2 ] );
+	ProjectPoint( mvp, view.targetSize, wsPts[ 0 ], ssPts[ 0 ] );
+	ProjectPoint( mvp, view.targetSize, wsPts[ 1 ], ssPts[ 1 ] );
+	ProjectPoint( mvp, view.targetSize, wsPts[ 2 ], ssPts[ 2 ] );
 
 	const bool nearClip = ( ssPts[ 0 ][ 2 ] < -1.0 ) && ( ssPts[ 1 ][ 2 ] < -1.0 ) && ( ssPts[ 2 ][ 2 ] < -1.0 );
 
 	if( !culled && !nearClip )
 	{
-		outVertex.clipPosition[ 0 ] = ssPts[ 0 ];
-		outVertex.wsPosition[ 0 ] = tri.v0.pos;
-		outVertex.color[ 0 ] = tri.v0.color;
-		outVertex.uv[ 0 ] = tri.v0.uv;
-		outVertex.normal[ 0 ] = tri.v0.normal;
-
-		outVertex.clipPosition[ 1 ] = ssPts[ 1 ];
-		outVertex.wsPosition[ 1 ] = tri.v1.pos;
-		outVertex.color[ 1 ] = tri.v1.color;
-		outVertex.uv[ 1 ] = tri.v1.uv;
-		outVertex.normal[ 1 ] = tri.v1.normal;
-
-		outVertex.clipPosition[ 2 ] = ssPts[ 2 ];
-		outVertex.wsPosition[ 2 ] = tri.v2.pos;
-		outVertex.color[ 2 ] = tri.v2.color;
-		outVertex.uv[ 2 ] = tri.v2.uv;
-		outVertex.normal[ 2 ] = tri.v2.normal;
-
+		for ( uint32_t v = 0; v < 3; ++v )
+		{
+			outVertex.clipPosition[ v ] = ssPts[ v ];
+			outVertex.wsPosition[ v ] = wsPts[ v ];
+			outVertex.color[ v ] = Vec4ToColor( UnpackRgba8( attrib.v[ v ].color ) );
+			outVertex.uv[ v ] = UnpackUv( attrib.v[ v ] );
+			outVertex.normal[ v ] = TransformNormal( instance.invTransform, DecodeOctNormal( attrib.v[ v ].normal ) );
+		}
 		return true;
 	}
 	else
@@ -299,19 +292,21 @@ inline bool PixelShader( const fragmentInput_t& frag )
 inline void RasterScene( ImageBuffer<Color>& image, ImageBuffer<float>& zBuffer, const RtView& view, const RtScene& rtScene, bool wireFrame )
 {
 	mat4x4f mvp = view.projTransform * view.viewTransform;
-	const uint32_t modelCnt = static_cast<uint32_t>( rtScene.models.size() );
+	const uint32_t instanceCnt = static_cast<uint32_t>( rtScene.instances.size() );
 
 #if DRAW_WIREFRAME
-	for ( uint32_t m = 0; m < modelCnt; ++m )
+	for ( uint32_t instanceIx = 0; instanceIx < instanceCnt; ++instanceIx )
 	{
-		const RtModel& model = rtScene.models[ m ];
-		const Triangle* triCache = model.triCache.data();
+		const RtInstance& instance = rtScene.instances[ instanceIx ];
+		const RtModelAccel& accel = *rtScene.modelAccels[ instance.modelIx ];
+		const uint16_t* slotMaterials = rtScene.modelMaterials[ instance.modelIx ].data();
+		const uint16_t* triSlots = accel.triMaterialSlots.data();
 
-		const size_t triCnt = model.triCache.size();
+		const uint32_t triCnt = accel.GetTriCount();
 		for ( uint32_t i = 0; i < triCnt; ++i )
 		{
 			vertexOut_t vo;
-			if ( !VertexShader( view, triCache[ i ], vo ) )
+			if ( !VertexShader( view, instance, accel, i, vo ) )
 			{
 				continue;
 			}
@@ -330,6 +325,16 @@ inline void RasterScene( ImageBuffer<Color>& image, ImageBuffer<float>& zBuffer,
 				const vec3f tPt1 = Trunc<4, 1>( vo.clipPosition[ 1 ] );
 				const vec3f tPt2 = Trunc<4, 1>( vo.clipPosition[ 2 ] );
 
+				// One level of detail per triangle from its texel to pixel area ratio
+				float texLod = 0.0f;
+				const rtMaterial_t& triMaterial = rtScene.materials[ slotMaterials[ triSlots[ i ] ] ];
+				if ( triMaterial.textured )
+				{
+					const vec3f ssArea = Cross( tPt1 - tPt0, tPt2 - tPt0 );
+					const float uvArea = UvArea( vo.uv[ 0 ], vo.uv[ 1 ], vo.uv[ 2 ] );
+					texLod = TextureLod( rtScene.textures->GetSize( triMaterial.colorMapIx ), uvArea, 0.5f * std::abs( ssArea[ 2 ] ), 1.0f );
+				}
+
 				const int32_t x0 = std::max( 0,										static_cast<int>( ssBox.min[ 0 ] ) );
 				const int32_t x1 = std::min( static_cast<int>( image.GetWidth() ),	static_cast<int>( ssBox.max[ 0 ] + 0.5 ) );
 				const int32_t y0 = std::max( 0,										static_cast<int>( ssBox.min[ 1 ] ) );
@@ -353,45 +358,28 @@ inline void RasterScene( ImageBuffer<Color>& image, ImageBuffer<float>& zBuffer,
 						const vec3f normal = Normalize( fragmentInput.normal );
 
 						const light_t& L = rtScene.lights[ 0 ];
-						const vec4f intensity = L.intensity * ColorToVector( L.color );
 
 						vec3f lightDir = Trunc<4, 1>( L.pos - fragmentInput.wsPosition );
 						lightDir = Normalize( lightDir );
 
 						const vec3f viewVector = Normalize( Trunc<4, 1>( view.camera.GetOrigin() - fragmentInput.wsPosition ) );
-						const Color viewDiffuse = Color( (float)Dot( viewVector, normal ) );
-
-						const vec3f halfVector = Normalize( viewVector + lightDir );
 
 						Color surfaceColor = Color::Black;
 
-						const Material& material = rtScene.assets->GetLib<Material>()->Find( triCache[ i ].materialId )->Get();
+						const rtMaterial_t& material = rtScene.materials[ slotMaterials[ triSlots[ i ] ] ];
 
-						if( material.IsTextured() )
+						if( material.textured )
 						{
-						//	const Image& texture = rtScene.assets->textureLib.Find( material.GetTexture( GGX_COLOR_MAP_SLOT ) )->Get();
-						//	surfaceColor = texture.cpuImage.GetPixelUV( fragmentInput.uv[ 0 ], fragmentInput.uv[ 1 ] ); // FIXME
+							surfaceColor = Vec4ToColor( rtScene.textures->SampleTrilinear( material.colorMapIx, fragmentInput.uv, texLod ) );
 						}
 						else
 						{
 							surfaceColor += fragmentInput.color;
 						}
 
-						const vec4f D = ColorToVector( Color( material.Kd() ) );
-						const vec4f S = ColorToVector( Color( material.Ks() ) );
-
-						const vec4f diffuseIntensity = Multiply( D, intensity ) * std::max( 0.0f, Dot( normal, lightDir ) );
-						const vec4f specularIntensity = S * pow( std::max( 0.0f, Dot( normal, halfVector ) ), material.Ns() );
-						const Color ambient = AmbientLight * ( Color( material.Ka() ) * surfaceColor );
-
-						Color shadingColor;
-						shadingColor = Vec4ToColor( specularIntensity );
-						shadingColor += Vec4ToColor( Multiply( diffuseIntensity, ColorToVector( surfaceColor ) ) );
-						shadingColor += ambient;
-
-						shadingColor = Vec3ToColor( BrdfGGX( normal, viewVector, lightDir, material ) );
-
-						const Color normalColor = Vec3ToColor( 0.5f * normal + vec3f( 0.5f ) );
+						// GGX shapes the response, the texel or vertex color tints it
+						const Color brdf = Vec3ToColor( BrdfGGX( normal, viewVector, lightDir, material.desc ) );
+						const Color shadingColor = Vec4ToColor( Multiply( ColorToVector( brdf ), ColorToVector( surfaceColor ) ) );
 
 						image.SetPixel( x, y, LinearToSrgb( shadingColor ).AsHex() );
 						zBuffer.SetPixel( x, y, depth );
@@ -426,11 +414,11 @@ inline void RasterScene( ImageBuffer<Color>& image, ImageBuffer<float>& zBuffer,
 
 	if ( wireFrame )
 	{
-		for ( uint32_t m = 0; m < modelCnt; ++m )
+		for ( uint32_t instanceIx = 0; instanceIx < instanceCnt; ++instanceIx )
 		{
-			const RtModel& model = rtScene.models[ m ];
+			const RtInstance& instance = rtScene.instances[ instanceIx ];
 #if DRAW_AABB
-			const AABB bounds = model.octree.GetAABB();
+			const AABB& bounds = instance.bounds;
 			DrawCube( image, view, vec4f( bounds.min, 1.0 ), vec4f( bounds.max, 1.0 ) );
 			DrawCube( image, view, vec4f( bounds.min, 1.0 ), vec4f( bounds.max, 1.0 ) );
 #endif
@@ -438,7 +426,7 @@ inline void RasterScene( ImageBuffer<Color>& image, ImageBuffer<float>& zBuffer,
 			vec3f xAxis;
 			vec3f yAxis;
 			vec3f zAxis;
-			OrthoMatrixToAxis( model.transform, origin, xAxis, yAxis, zAxis );
+			OrthoMatrixToAxis( instance.transform, origin, xAxis, yAxis, zAxis );
 			DrawWorldAxis( image, view, 20.0f, origin, xAxis, yAxis, zAxis );
 		}
 	}
@@ -28,13 +28,13 @@
 //
 // Requires: rt_common.h (shared types), GfxCore (submodule)
 //
-// Contains hit-test types, ray-scene intersection, recursive
+// Contains hit-test types, two-level ray-scene intersection, recursive
 // ray tracing with reflection/shadow support, and multi-threaded
 // tile-based scene tracing.
 //
 
 #include "rt_common.h"
-#include <thread>
+#include "threadPool.h"
 
 
 // ============================================================
@@ -51,6 +51,19 @@ enum hitCode_t : uint32_t
 };
 
 
+// Minimal result of an intersection query. Surface attributes are
+// reconstructed from it once traversal has finished.
+struct hitRecord_t
+{
+	float		t;
+	float		u;
+	float		v;
+	uint32_t	triIx;
+	uint32_t	instanceIx;
+	hitCode_t	hitCode;
+};
+
+
 struct sample_t
 {
 	Color		color;
@@ -60,8 +73,49 @@ struct sample_t
 	float		t;
 	float		surfaceDot;
 	uint32_t	modelIx;
+	uint32_t	instanceIx;
 	hitCode_t	hitCode;
-	hdl_t		materialId;
+	uint32_t	materialIx;
+};
+
+
+// Continuation of a path out of a shaded hit. A zero weight ends the path.
+struct pathBounce_t
+{
+	Ray			ray;
+	float		weight;
+};
+
+
+// Resolved pixels of one tile. Workers fill their own buffer and write it
+// to the shared images once the tile is done.
+struct tileBuffer_t
+{
+	vec2i					origin;
+	uint32_t				width;
+	uint32_t				height;
+	std::vector<Color>		color;		// Coverage in alpha
+	std::vector<Color>		diffuse;
+	std::vector<Color>		normal;
+	std::vector<uint8_t>	covered;
+	std::vector<float>		aov;		// AovTotalChannels planes of the tile
+	uint32_t				aovMask;
+};
+
+
+// Running totals for one pixel over its subsamples
+struct pixelAccum_t
+{
+	Color		color;
+	vec3f		normal;
+	float		diffuse; // Eye-to-Surface
+	float		coverage;
+	float		t;			// Summed over the samples that hit a surface
+	Color		albedo;
+	uint32_t	modelIx;	// First surface hit, ~0u if there is none
+	uint32_t	materialIx;
+	uint32_t	hitCnt;
+	uint32_t	sampleCnt;
 };
 
 
@@ -69,13 +123,109 @@ struct sample_t
 // Declarations
 // ============================================================
 
-sample_t	RayTrace_r( const Ray& ray, const RtScene& rtScene, const uint32_t rayDepth );
+Color		ShadeLight( const sample_t& surfaceSample, const rtMaterial_t& material, const Color& surfaceColor, const vec3f& viewVector, const light_t& L, const vec3f& toLight );
+template<class LightCallback>
+void		ForEachLightSample( const RtScene& rtScene, const sample_t& surfaceSample, Sampler& sampler, LightCallback onLight );
+template<uint32_t Features>
+sample_t	RayTrace( const Ray& ray, const RtScene& rtScene, const renderSettings_t& settings, Sampler& sampler );
+template<uint32_t Features>
+sample_t	TracePath( const Ray& primaryRay, const hitRecord_t& primaryHit, const RtScene& rtScene, const renderSettings_t& settings, Sampler& sampler );
+bool		SurvivesRoulette( const renderSettings_t& settings, const uint32_t depth, float& throughput, Sampler& sampler );
+template<uint32_t Features>
+sample_t	ShadeMiss( const Ray& ray, const hitRecord_t& hit );
+template<uint32_t Features>
+sample_t	ShadeHit( const Ray& ray, const RtScene& rtScene, const renderSettings_t& settings, const hitRecord_t& hit, Sampler& sampler, const uint32_t rayDepth, pathBounce_t& outBounce );
 sample_t	RecordSkyInfo( const Ray& r, const float t );
-sample_t	RecordSurfaceInfo( const Ray& r, const float t, const RtScene& rtScene, const uint32_t triIndex, const uint32_t modelIx );
-bool		IntersectScene( const Ray& ray, const RtScene& rtScene, const bool cullBackfaces, const bool stopAtFirstIntersection, sample_t& outSample );
-void		TracePixel( const RtView& view, const RtScene& rtScene, ImageBuffer<Color>& image, const uint32_t px, const uint32_t py );
-void		TracePatch( const RtView& view, const RtScene& rtScene, ImageBuffer<Color>* image, const vec2i& p0, const vec2i& p1 );
-void		TraceScene( const RtView& view, const RtScene& rtScene, ImageBuffer<Color>& image );
+template<uint32_t Features>
+sample_t	RecordSurfaceInfo( const Ray& r, const RtScene& rtScene, const hitRecord_t& hit );
+traceRay_t	ToObjectSpace( const traceRay_t& ray, const RtInstance& instance );
+bool		IntersectInstance( const traceRay_t& ray, const RtScene& rtScene, const uint32_t instanceIx, const bool cullBackfaces, const bool stopAtFirstIntersection, hitRecord_t& outHit );
+bool		IntersectScene( const traceRay_t& ray, const RtScene& rtScene, const bool cullBackfaces, const bool stopAtFirstIntersection, hitRecord_t& outHit );
+bool		IntersectScene( const Ray& ray, const RtScene& rtScene, const bool cullBackfaces, const bool stopAtFirstIntersection, hitRecord_t& outHit );
+bool		OccludedInstance( const traceRay_t& ray, const RtScene& rtScene, const uint32_t instanceIx, const float tMin, const float tMax );
+bool		Occluded( const traceRay_t& ray, const RtScene& rtScene, const float tMin, const float tMax );
+bool		Occluded( const Ray& ray, const RtScene& rtScene, const float tMin, const float tMax );
+void		IntersectInstancePacket( const rayPacket_t& packet, const RtScene& rtScene, const uint32_t instanceIx, const bool cullBackfaces, hitRecord_t* outHits );
+void		IntersectScenePacket( const rayPacket_t& packet, const RtScene& rtScene, const bool cullBackfaces, hitRecord_t* outHits );
+uint32_t	AddInstance( AssetManager& assets, RtScene& rtScene, const Entity& ent );
+void		PackTriangleStreams( const RtModel& model, RtModelAccel& accel );
+void		BuildModelAccel( const RtModel& model, RtModelAccel& accel );
+void		SetInstanceTransform( const RtScene& rtScene, RtInstance& instance, const mat4x4f& transform );
+void		GatherInstanceBounds( const RtScene& rtScene, std::vector<AABB>& outBounds );
+void		BuildSceneBvh( RtScene& rtScene );
+void		RefitSceneBvh( RtScene& rtScene );
+rtMaterial_t	MakeRtMaterial( const Material& material );
+void		BuildMaterialTable( RtScene& rtScene );
+vec2f		SubPixelOffset( Sampler& sampler );
+void		ClearAccum( pixelAccum_t& accum );
+void		AccumulateSample( pixelAccum_t& accum, const sample_t& sample );
+void		BeginTile( tileBuffer_t& tile, const vec2i& p0, const vec2i& p1, const uint32_t aovMask );
+void		ResolveAovs( tileBuffer_t& tile, const uint32_t localIx, const pixelAccum_t& accum );
+void		ResolvePixel( tileBuffer_t& tile, const uint32_t px, const uint32_t py, const pixelAccum_t& accum );
+template<uint32_t Features>
+void		WriteTile( const tileBuffer_t& tile, ImageBuffer<Color>& image, debug_t& dbg );
+template<uint32_t Features>
+void		TracePixel( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile, const uint32_t px, const uint32_t py );
+template<uint32_t Features>
+void		TracePacket( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile, const vec2i& p0, const vec2i& p1 );
+template<uint32_t Features>
+void		TraceTileBuffer( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile );
+template<uint32_t Features>
+void		TracePatch( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>* image, debug_t* dbg, const vec2i& p0, const vec2i& p1 );
+void		TraceScene( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg );
+
+typedef void ( *tracePatchKernel_t )( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>* image, debug_t* dbg, const vec2i& p0, const vec2i& p1 );
+
+struct TracePatchKernels
+{
+	typedef tracePatchKernel_t kernel_t;
+
+	template<uint32_t Features>
+	static void Run( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>* image, debug_t* dbg, const vec2i& p0, const vec2i& p1 )
+	{
+		TracePatch<Features>( view, rtScene, settings, image, dbg, p0, p1 );
+	}
+};
+
+typedef void ( *traceTileBufferKernel_t )( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile );
+
+struct TraceTileBufferKernels
+{
+	typedef traceTileBufferKernel_t kernel_t;
+
+	template<uint32_t Features>
+	static void Run( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile )
+	{
+		TraceTileBuffer<Features>( view, rtScene, settings, tile );
+	}
+};
+
+// Mutable staging side of an RtScene. Edit() hands out the staging scene and
+// Commit() freezes it into a snapshot shared by every worker for the frame.
+// Frames that only move instances go through SetInstanceTransform() instead,
+// which lets Commit() refit the top level hierarchy rather than rebuild it.
+class RtSceneBuilder
+{
+public:
+	RtSceneBuilder() : dirty( true ), rebuild( true ) {}
+
+	RtScene&		Edit();
+	void			SetInstanceTransform( const uint32_t instanceIx, const mat4x4f& transform );
+	RtSceneRef		Commit();
+
+	inline RtSceneRef GetSnapshot() const
+	{
+		return snapshot;
+	}
+
+private:
+	RtScene&		Stage();
+
+	RtScene			staging;
+	RtSceneRef		snapshot;
+	bool			dirty;		// Staging differs from the snapshot
+	bool			rebuild;	// Something besides instance transforms changed
+};
 
 // Forward declaration — defined in raster.h
 void		DrawRay( ImageBuffer<Color>& image, const RtView& view, const Ray& ray, const Color& color );
@@ -102,50 +252,70 @@ inline sample_t RecordSkyInfo( const Ray& r, const float t )
 	sample.normal = vec3f( 0.0 );
 	sample.hitCode = HIT_SKY;
 	sample.modelIx = ResourceManager::InvalidModelIx;
+	sample.instanceIx = ResourceManager::InvalidModelIx;
 	sample.pt = vec3f( 0.0 );
 	sample.surfaceDot = 0.0;
 	sample.t = t;
-	sample.materialId = 0;
+	sample.materialIx = 0;
 
 	return sample;
 }
 
 
-inline sample_t RecordSurfaceInfo( const Ray& r, const float t, const RtScene& rtScene, const uint32_t triIndex, const uint32_t modelIx )
+template<uint32_t Features>
+inline sample_t RecordSurfaceInfo( const Ray& r, const RtScene& rtScene, const hitRecord_t& hit )
 {
-	const RtModel& model = rtScene.models[ modelIx ];
-	const std::vector<Triangle>& triCache = model.triCache;
-	const Triangle& tri = triCache[ triIndex ];
+	const RtInstance& instance = rtScene.instances[ hit.instanceIx ];
+	const uint32_t modelIx = instance.modelIx;
+	const RtModelAccel& accel = *rtScene.modelAccels[ modelIx ];
+	const triAttrib_t& attrib = accel.attribs[ hit.triIx ];
 
 	sample_t sample;
 
-	sample.pt = r.GetPoint( t );
-	sample.t = t;
+	sample.pt = r.o + hit.t * r.GetVector();
+	sample.t = hit.t;
 
-	const vec3f b = PointToBarycentric( sample.pt, Trunc<4, 1>( tri.v0.pos ), Trunc<4, 1>( tri.v1.pos ), Trunc<4, 1>( tri.v2.pos ) );
-#if PHONG_NORMALS
-	sample.normal = ( b[ 0 ] * tri.v0.normal ) + ( b[ 1 ] * tri.v1.normal ) + ( b[ 2 ] * tri.v2.normal );
-	sample.normal = Normalize( sample.normal );
-#else
-	sample.normal = tri.n;
-#endif
+	const vec3f b = vec3f( 1.0f - hit.u - hit.v, hit.u, hit.v );
+	if ( Features & RENDER_PHONG_NORMALS ) {
+		sample.normal = ( b[ 0 ] * DecodeOctNormal( attrib.v[ 0 ].normal ) ) + ( b[ 1 ] * DecodeOctNormal( attrib.v[ 1 ].normal ) ) + ( b[ 2 ] * DecodeOctNormal( attrib.v[ 2 ].normal ) );
+	} else {
+		sample.normal = DecodeOctNormal( attrib.faceNormal );
+	}
+	sample.normal = Normalize( TransformNormal( instance.invTransform, sample.normal ) );
 
-	vec4f color0 = ColorToVector( tri.v0.color );
-	vec4f color1 = ColorToVector( tri.v1.color );
-	vec4f color2 = ColorToVector( tri.v2.color );
+	vec4f color0 = UnpackRgba8( attrib.v[ 0 ].color );
+	vec4f color1 = UnpackRgba8( attrib.v[ 1 ].color );
+	vec4f color2 = UnpackRgba8( attrib.v[ 2 ].color );
 	vec4f mixedColor = b[ 0 ] * color0 + b[ 1 ] * color1 + b[ 2 ] * color2;
 	sample.color = Vec4ToColor( mixedColor );
 
 	sample.albedo = sample.color;
 
-	sample.materialId = tri.materialId;
+	sample.materialIx = rtScene.modelMaterials[ modelIx ][ accel.triMaterialSlots[ hit.triIx ] ];
 
-	const Asset<Material>* material = rtScene.assets->GetLib<Material>()->Find( sample.materialId );
-	if ( ( material != nullptr ) && material->Get().IsTextured() )
+	const rtMaterial_t& material = rtScene.materials[ sample.materialIx ];
+	if ( material.textured )
 	{
-	//	const Image& texture = rtScene.assets->textureLib.Find( material->Get().GetTexture( GGX_COLOR_MAP_SLOT ) )->Get();
-	//	vec2f uv = b[ 0 ] * tri.v0.uv + b[ 1 ] * tri.v1.uv + b[ 2 ] * tri.v2.uv;
-	//	sample.albedo = reinterpret_cast<ImageBuffer<rgba8_t>*>(texture.cpuImage)->GetPixelUV( uv[ 0 ], uv[ 1 ] );
+		const vec2f uv0 = UnpackUv( attrib.v[ 0 ] );
+		const vec2f uv1 = UnpackUv( attrib.v[ 1 ] );
+		const vec2f uv2 = UnpackUv( attrib.v[ 2 ] );
+		const vec2f uv = b[ 0 ] * uv0 + b[ 1 ] * uv1 + b[ 2 ] * uv2;
+
+		// Ray cone: the pixel's spread angle widened by the hit distance and incidence
+		vec3f pts[ 3 ];
+		accel.GetTriPositions( hit.triIx, pts );
+		const vec3f e1 = TransformVector( instance.transform, pts[ 1 ] - pts[ 0 ] );
+		const vec3f e2 = TransformVector( instance.transform, pts[ 2 ] - pts[ 0 ] );
+		const vec3f areaVector = Cross( e1, e2 );
+		const float worldArea = 0.5f * sqrt( Dot( areaVector, areaVector ) );
+
+		const float pixelSpread = ( CameraFov * 3.14159265f / 180.0f ) / RenderHeight;
+		const float cosTheta = std::max( 0.01f, std::abs( Dot( Normalize( r.GetVector() ), sample.normal ) ) );
+		const float footprint = hit.t * pixelSpread / cosTheta;
+
+		TextureCache& textures = *rtScene.textures;
+		const float lod = TextureLod( textures.GetSize( material.colorMapIx ), UvArea( uv0, uv1, uv2 ), worldArea, footprint );
+		sample.albedo = Vec4ToColor( textures.SampleTrilinear( material.colorMapIx, uv, lod ) );
 	}
 
 	sample.surfaceDot = Dot( r.GetVector(), sample.normal );
@@ -159,244 +329,1059 @@ inline sample_t RecordSurfaceInfo( const Ray& r, const float t, const RtScene& r
 	}
 
 	sample.modelIx = modelIx;
+	sample.instanceIx = hit.instanceIx;
 
 	return sample;
 }
 
 
-inline bool IntersectScene( const Ray& ray, const RtScene& rtScene, const bool cullBackfaces, const bool stopAtFirstIntersection, sample_t& outSample )
+inline traceRay_t ToObjectSpace( const traceRay_t& ray, const RtInstance& instance )
 {
-	outSample.t = FLT_MAX;
-	outSample.hitCode = HIT_SKY;
+	// The direction is not renormalized so t is the same in both spaces
+	const vec3f o = TransformPoint( instance.invTransform, ray.o );
+	const vec3f d = TransformVector( instance.invTransform, ray.d );
+	return MakeTraceRay( o, d );
+}
 
-	int hitCnt = 0;
 
-	const uint32_t modelCnt = static_cast<uint32_t>( rtScene.models.size() );
-	for ( uint32_t modelIx = 0; modelIx < modelCnt; ++modelIx )
+inline bool IntersectInstance( const traceRay_t& ray, const RtScene& rtScene, const uint32_t instanceIx, const bool cullBackfaces, const bool stopAtFirstIntersection, hitRecord_t& outHit )
+{
+	const RtInstance& instance = rtScene.instances[ instanceIx ];
+	const RtModelAccel& accel = *rtScene.modelAccels[ instance.modelIx ];
+	const triBlock_t* triBlocks = accel.triBlocks.data();
+	const triBlockKernel_t IntersectTriBlock = GetTriBlockKernel();
+
+	const traceRay_t objRay = ToObjectSpace( ray, instance );
+
+	bool hit = false;
+	TraverseBvh( accel.bvh, objRay, outHit.t, [&]( const bvhNode_t& node ) -> bool
 	{
-		const RtModel& model = rtScene.models[ modelIx ];
+		for ( uint32_t i = 0; i < node.primCnt; ++i )
+		{
+			triBlockHit_t blockHit;
+			if ( IntersectTriBlock( triBlocks[ node.offset + i ], objRay, cullBackfaces, MinT, outHit.t, blockHit ) )
+			{
+				outHit.t = blockHit.t;
+				outHit.u = blockHit.u;
+				outHit.v = blockHit.v;
+				outHit.triIx = blockHit.triIx;
+				outHit.instanceIx = instanceIx;
+				outHit.hitCode = blockHit.isBackface ? HIT_BACKFACE : HIT_FRONTFACE;
+				hit = true;
+
+				if ( stopAtFirstIntersection )
+					return true;
+			}
+		}
+		return false;
+	} );
+
+	return hit;
+}
+
+
+inline bool IntersectScene( const traceRay_t& traceRay, const RtScene& rtScene, const bool cullBackfaces, const bool stopAtFirstIntersection, hitRecord_t& outHit )
+{
+	outHit.t = FLT_MAX;
+	outHit.hitCode = HIT_NONE;
+
+	const Bvh& bvh = rtScene.bvh;
+	if ( bvh.IsEmpty() ) {
+		return false;
+	}
 
-#if USE_AABB
-		float t0 = 0.0;
-		float t1 = 0.0;
-		if ( !model.octree.GetAABB().Intersect( ray, t0, t1 ) )
+	float tRoot;
+	if ( !IntersectAABB( traceRay, bvh.GetAABB(), outHit.t, tRoot ) ) {
+		return false;
+	}
+	outHit.hitCode = HIT_AABB;
+
+	TraverseBvh( bvh, traceRay, outHit.t, [&]( const bvhNode_t& node ) -> bool
+	{
+		for ( uint32_t i = 0; i < node.primCnt; ++i )
 		{
-			continue;
+			const uint32_t instanceIx = bvh.primIndices[ node.offset + i ];
+			if ( IntersectInstance( traceRay, rtScene, instanceIx, cullBackfaces, stopAtFirstIntersection, outHit ) && stopAtFirstIntersection ) {
+				return true;
+			}
 		}
-#endif
-		if( outSample.hitCode == HIT_NONE ) {
-			outSample.hitCode = HIT_AABB;
+		return false;
+	} );
+
+	return ( outHit.hitCode == HIT_FRONTFACE ) || ( outHit.hitCode == HIT_BACKFACE );
+}
+
+
+inline bool IntersectScene( const Ray& ray, const RtScene& rtScene, const bool cullBackfaces, const bool stopAtFirstIntersection, hitRecord_t& outHit )
+{
+	return IntersectScene( MakeTraceRay( ray ), rtScene, cullBackfaces, stopAtFirstIntersection, outHit );
+}
+
+
+inline bool OccludedInstance( const traceRay_t& ray, const RtScene& rtScene, const uint32_t instanceIx, const float tMin, const float tMax )
+{
+	const RtInstance& instance = rtScene.instances[ instanceIx ];
+	const RtModelAccel& accel = *rtScene.modelAccels[ instance.modelIx ];
+	const triBlock_t* triBlocks = accel.triBlocks.data();
+	const triBlockKernel_t IntersectTriBlock = GetTriBlockKernel();
+
+	const traceRay_t objRay = ToObjectSpace( ray, instance );
+
+	return TraverseBvhAny( accel.bvh, objRay, tMax, [&]( const bvhNode_t& node ) -> bool
+	{
+		for ( uint32_t i = 0; i < node.primCnt; ++i )
+		{
+			triBlockHit_t blockHit;
+			if ( IntersectTriBlock( triBlocks[ node.offset + i ], objRay, false, tMin, tMax, blockHit ) ) {
+				return true;
+			}
 		}
+		return false;
+	} );
+}
 
-		const std::vector<Triangle>& triCache = model.triCache;
-		std::vector<uint32_t> triIndices;
-		model.octree.Intersect( ray, triIndices );
 
-		const size_t triCnt = triIndices.size();
-		for ( size_t ix = 0; ix < triCnt; ++ix )
+// Shadow query: true if anything blocks the segment [tMin, tMax] of the ray.
+// Both faces occlude and no surface data is produced.
+inline bool Occluded( const traceRay_t& ray, const RtScene& rtScene, const float tMin, const float tMax )
+{
+	const Bvh& bvh = rtScene.bvh;
+	return TraverseBvhAny( bvh, ray, tMax, [&]( const bvhNode_t& node ) -> bool
+	{
+		for ( uint32_t i = 0; i < node.primCnt; ++i )
 		{
-			const uint32_t triIx = triIndices[ ix ];
-			const Triangle& tri = triCache[ triIx ];
+			if ( OccludedInstance( ray, rtScene, bvh.primIndices[ node.offset + i ], tMin, tMax ) ) {
+				return true;
+			}
+		}
+		return false;
+	} );
+}
+
+
+inline bool Occluded( const Ray& ray, const RtScene& rtScene, const float tMin, const float tMax )
+{
+	return Occluded( MakeTraceRay( ray ), rtScene, tMin, tMax );
+}
+
 
-			float t;
-			bool isBackface;
-			if ( RayToTriangleIntersection( ray, tri, isBackface, t ) )
+inline void IntersectInstancePacket( const rayPacket_t& packet, const RtScene& rtScene, const uint32_t instanceIx, const bool cullBackfaces, hitRecord_t* outHits )
+{
+	const RtInstance& instance = rtScene.instances[ instanceIx ];
+
+	rayPacket_t objPacket;
+	objPacket.rayCnt = packet.rayCnt;
+	for ( uint32_t r = 0; r < packet.rayCnt; ++r ) {
+		objPacket.rays[ r ] = ToObjectSpace( packet.rays[ r ], instance );
+	}
+	FinalizePacket( objPacket );
+
+	// The instance rotation can split direction signs, so fall back to single rays
+	if ( !objPacket.coherent )
+	{
+		for ( uint32_t r = 0; r < packet.rayCnt; ++r ) {
+			IntersectInstance( packet.rays[ r ], rtScene, instanceIx, cullBackfaces, false, outHits[ r ] );
+		}
+		return;
+	}
+
+	const RtModelAccel& accel = *rtScene.modelAccels[ instance.modelIx ];
+	const triBlock_t* triBlocks = accel.triBlocks.data();
+	const triBlockKernel_t IntersectTriBlock = GetTriBlockKernel();
+
+	float tMax[ PacketRayCnt ];
+	for ( uint32_t r = 0; r < packet.rayCnt; ++r ) {
+		tMax[ r ] = outHits[ r ].t;
+	}
+
+	TraverseBvhPacket( accel.bvh, objPacket, tMax, [&]( const bvhNode_t& node )
+	{
+		for ( uint32_t r = 0; r < objPacket.rayCnt; ++r )
+		{
+			const traceRay_t& objRay = objPacket.rays[ r ];
+			hitRecord_t& outHit = outHits[ r ];
+
+			float tEntry;
+			if ( !IntersectAABB( objRay, node.bounds, outHit.t, tEntry ) ) {
+				continue;
+			}
+
+			for ( uint32_t i = 0; i < node.primCnt; ++i )
 			{
-				if ( t > outSample.t )
-					continue;
+				triBlockHit_t blockHit;
+				if ( IntersectTriBlock( triBlocks[ node.offset + i ], objRay, cullBackfaces, MinT, outHit.t, blockHit ) )
+				{
+					outHit.t = blockHit.t;
+					outHit.u = blockHit.u;
+					outHit.v = blockHit.v;
+					outHit.triIx = blockHit.triIx;
+					outHit.instanceIx = instanceIx;
+					outHit.hitCode = blockHit.isBackface ? HIT_BACKFACE : HIT_FRONTFACE;
+				}
+			}
+			tMax[ r ] = outHit.t;
+		}
+	} );
+}
 
-				if ( cullBackfaces && isBackface )
-					continue;
 
-				outSample = RecordSurfaceInfo( ray, t, rtScene, triIx, modelIx );
+inline void IntersectScenePacket( const rayPacket_t& packet, const RtScene& rtScene, const bool cullBackfaces, hitRecord_t* outHits )
+{
+	if ( !packet.coherent )
+	{
+		for ( uint32_t r = 0; r < packet.rayCnt; ++r ) {
+			IntersectScene( packet.rays[ r ], rtScene, cullBackfaces, false, outHits[ r ] );
+		}
+		return;
+	}
 
-				if ( stopAtFirstIntersection )
-					return true;
+	const Bvh& bvh = rtScene.bvh;
+
+	float tMax[ PacketRayCnt ];
+	for ( uint32_t r = 0; r < packet.rayCnt; ++r )
+	{
+		outHits[ r ].t = FLT_MAX;
+		outHits[ r ].hitCode = HIT_NONE;
+
+		float tRoot;
+		if ( !bvh.IsEmpty() && IntersectAABB( packet.rays[ r ], bvh.GetAABB(), outHits[ r ].t, tRoot ) ) {
+			outHits[ r ].hitCode = HIT_AABB;
+		}
+		tMax[ r ] = outHits[ r ].t;
+	}
+
+	TraverseBvhPacket( bvh, packet, tMax, [&]( const bvhNode_t& node )
+	{
+		for ( uint32_t i = 0; i < node.primCnt; ++i )
+		{
+			const uint32_t instanceIx = bvh.primIndices[ node.offset + i ];
+			IntersectInstancePacket( packet, rtScene, instanceIx, cullBackfaces, outHits );
+		}
+		for ( uint32_t r = 0; r < packet.rayCnt; ++r ) {
+			tMax[ r ] = outHits[ r ].t;
+		}
+	} );
+}
+
+
+// Packs the model's shading data into a quantized attribute stream and
+// replaces material handles with per-model slots. Positions go straight
+// into the triangle blocks.
+inline void PackTriangleStreams( const RtModel& model, RtModelAccel& accel )
+{
+	const size_t triCnt = model.triCache.size();
+	accel.attribs.resize( triCnt );
+	accel.triMaterialSlots.resize( triCnt );
+	accel.materialHdls.clear();
+
+	for ( size_t i = 0; i < triCnt; ++i )
+	{
+		const Triangle& tri = model.triCache[ i ];
+
+		triAttrib_t& attrib = accel.attribs[ i ];
+		attrib.v[ 0 ] = PackVertexAttrib( tri.v0.normal, tri.v0.uv, ColorToVector( tri.v0.color ) );
+		attrib.v[ 1 ] = PackVertexAttrib( tri.v1.normal, tri.v1.uv, ColorToVector( tri.v1.color ) );
+		attrib.v[ 2 ] = PackVertexAttrib( tri.v2.normal, tri.v2.uv, ColorToVector( tri.v2.color ) );
+		attrib.faceNormal = EncodeOctNormal( tri.n );
+
+		// Models use a handful of materials, so a linear search is enough
+		auto slot = std::find( accel.materialHdls.begin(), accel.materialHdls.end(), tri.materialId );
+		if ( slot == accel.materialHdls.end() )
+		{
+			assert( accel.materialHdls.size() < 0xFFFF );
+			accel.materialHdls.push_back( tri.materialId );
+			slot = accel.materialHdls.end() - 1;
+		}
+		accel.triMaterialSlots[ i ] = static_cast<uint16_t>( slot - accel.materialHdls.begin() );
+	}
+}
+
+
+inline void BuildModelAccel( const RtModel& model, RtModelAccel& accel )
+{
+	PackTriangleStreams( model, accel );
+
+	const uint32_t triCnt = accel.GetTriCount();
+	std::vector<AABB> triBounds( triCnt );
+	for ( uint32_t i = 0; i < triCnt; ++i )
+	{
+		const Triangle& tri = model.triCache[ i ];
+		triBounds[ i ].Expand( Trunc<4, 1>( tri.v0.pos ) );
+		triBounds[ i ].Expand( Trunc<4, 1>( tri.v1.pos ) );
+		triBounds[ i ].Expand( Trunc<4, 1>( tri.v2.pos ) );
+	}
+
+	Bvh& bvh = accel.bvh;
+	bvh.Build( triBounds, TriBlockWidth );
+
+	// Repack each leaf's triangles into blocks and point the leaf at them
+	accel.triBlocks.clear();
+	accel.triBlocks.reserve( ( triCnt + TriBlockWidth - 1 ) / TriBlockWidth );
+	accel.triLanes.resize( triCnt );
+
+	const size_t nodeCnt = bvh.nodes.size();
+	for ( size_t n = 0; n < nodeCnt; ++n )
+	{
+		bvhNode_t& node = bvh.nodes[ n ];
+		if ( node.primCnt == 0 ) {
+			continue;
+		}
+
+		const uint32_t firstBlock = static_cast<uint32_t>( accel.triBlocks.size() );
+		for ( uint32_t i = 0; i < node.primCnt; ++i )
+		{
+			const uint32_t lane = i % TriBlockWidth;
+			if ( lane == 0 )
+			{
+				accel.triBlocks.push_back( triBlock_t() );
+				ClearTriBlock( accel.triBlocks.back() );
+			}
+
+			const uint32_t triIx = bvh.primIndices[ node.offset + i ];
+			const Triangle& tri = model.triCache[ triIx ];
+			SetTriBlockLane( accel.triBlocks.back(), lane, Trunc<4, 1>( tri.v0.pos ), Trunc<4, 1>( tri.v1.pos ), Trunc<4, 1>( tri.v2.pos ), triIx );
+			accel.triLanes[ triIx ] = static_cast<uint32_t>( accel.triBlocks.size() - 1 ) * TriBlockWidth + lane;
+		}
+
+		node.offset = firstBlock;
+		node.primCnt = static_cast<uint16_t>( accel.triBlocks.size() - firstBlock );
+	}
+
+	bvh.primIndices.clear();
+	bvh.primIndices.shrink_to_fit();
+}
+
+
+inline uint32_t AddInstance( AssetManager& assets, RtScene& rtScene, const Entity& ent )
+{
+	// Bottom level models are built once per Model handle with an identity transform
+	uint32_t modelIx = 0;
+	const uint32_t modelCnt = static_cast<uint32_t>( rtScene.modelHdls.size() );
+	for ( ; modelIx < modelCnt; ++modelIx )
+	{
+		if ( rtScene.modelHdls[ modelIx ] == ent.modelHdl ) {
+			break;
+		}
+	}
+
+	if ( modelIx == modelCnt )
+	{
+		Entity protoEnt;
+		protoEnt.modelHdl = ent.modelHdl;
+
+		std::shared_ptr<RtModel> model = std::make_shared<RtModel>();
+		CreateRayTraceModel( assets, &protoEnt, model.get() );
+
+		std::shared_ptr<RtModelAccel> accel = std::make_shared<RtModelAccel>();
+		BuildModelAccel( *model, *accel );
+
+		// Everything downstream reads the accel's streams
+		std::vector<Triangle>().swap( model->triCache );
+
+		// Never modified again, so later snapshots share them
+		rtScene.models.push_back( model );
+		rtScene.modelAccels.push_back( accel );
+		rtScene.modelMaterials.push_back( std::vector<uint16_t>() );
+		rtScene.modelHdls.push_back( ent.modelHdl );
+	}
+
+	RtInstance instance;
+	instance.modelIx = modelIx;
+	SetInstanceTransform( rtScene, instance, ent.GetMatrix() );
+
+	rtScene.instances.push_back( instance );
+	return static_cast<uint32_t>( rtScene.instances.size() - 1 );
+}
+
+
+inline void SetInstanceTransform( const RtScene& rtScene, RtInstance& instance, const mat4x4f& transform )
+{
+	instance.transform = transform;
+	instance.invTransform = AffineInverse( transform );
+	const Bvh& modelBvh = rtScene.modelAccels[ instance.modelIx ]->bvh;
+	instance.bounds = modelBvh.IsEmpty() ? AABB() : TransformBounds( transform, modelBvh.GetAABB() );
+}
+
+
+inline void GatherInstanceBounds( const RtScene& rtScene, std::vector<AABB>& outBounds )
+{
+	const size_t instanceCnt = rtScene.instances.size();
+	outBounds.clear();
+	outBounds.reserve( instanceCnt );
+	for ( size_t i = 0; i < instanceCnt; ++i ) {
+		outBounds.push_back( rtScene.instances[ i ].bounds );
+	}
+}
+
+
+inline void BuildSceneBvh( RtScene& rtScene )
+{
+	std::vector<AABB> instanceBounds;
+	GatherInstanceBounds( rtScene, instanceBounds );
+
+	rtScene.bvh.Build( instanceBounds, 1 );
+	rtScene.bvhBuildCost = rtScene.bvh.SahCost();
+}
+
+
+// Moves the top level bounds with the instances. Falls back to a full build
+// once the refit tree costs too much more than a fresh one would.
+inline void RefitSceneBvh( RtScene& rtScene )
+{
+	if ( rtScene.bvh.primIndices.size() != rtScene.instances.size() )
+	{
+		BuildSceneBvh( rtScene );
+		return;
+	}
+
+	std::vector<AABB> instanceBounds;
+	GatherInstanceBounds( rtScene, instanceBounds );
+
+	rtScene.bvh.Refit( instanceBounds );
+	if ( rtScene.bvh.SahCost() > ( BvhRefitRebuildRatio * rtScene.bvhBuildCost ) ) {
+		BuildSceneBvh( rtScene );
+	}
+}
+
+
+inline rtMaterial_t MakeRtMaterial( const Material& material )
+{
+	rtMaterial_t rtMaterial;
+	rtMaterial.Kd = ColorToVector( Color( material.Kd() ) );
+	rtMaterial.Ks = ColorToVector( Color( material.Ks() ) );
+	rtMaterial.Ka = ColorToVector( Color( material.Ka() ) );
+	rtMaterial.Ns = material.Ns();
+	rtMaterial.Tr = material.Tr();
+	rtMaterial.textured = material.IsTextured();
+	rtMaterial.colorMapIx = InvalidTextureIx;
+	rtMaterial.desc = material;
+	return rtMaterial;
+}
+
+
+// Gathers the materials referenced by the scene's models into a dense table
+// and maps every model's material slots into it. Triangles reach the table
+// through their slot, so the shared accels are left untouched.
+inline void BuildMaterialTable( RtScene& rtScene )
+{
+	rtScene.materials.clear();
+
+	// Published snapshots may be sampling the current cache, so new images go
+	// into a fork. A fresh cache is not visible to anyone yet.
+	bool ownsTextures = false;
+	if ( !rtScene.textures )
+	{
+		rtScene.textures = std::make_shared<TextureCache>();
+		ownsTextures = true;
+	}
+
+	std::map<hdl_t, uint16_t> tableIx;
+	auto materialLib = rtScene.assets->GetLib<Material>();
+	auto textureLib = rtScene.assets->GetLib<Texture>();
+
+	const size_t modelCnt = rtScene.models.size();
+	for ( size_t modelIx = 0; modelIx < modelCnt; ++modelIx )
+	{
+		const RtModelAccel& accel = *rtScene.modelAccels[ modelIx ];
+
+		// Resolve each of the model's materials once
+		const size_t slotCnt = accel.materialHdls.size();
+		std::vector<uint16_t>& slotMaterials = rtScene.modelMaterials[ modelIx ];
+		slotMaterials.resize( slotCnt );
+		for ( size_t slot = 0; slot < slotCnt; ++slot )
+		{
+			const hdl_t materialId = accel.materialHdls[ slot ];
+			auto it = tableIx.find( materialId );
+			if ( it == tableIx.end() )
+			{
+				assert( rtScene.materials.size() < MaxSceneMaterials );
+
+				const Asset<Material>* material = materialLib->Find( materialId );
+				rtScene.materials.push_back( MakeRtMaterial( ( material != nullptr ) ? material->Get() : DefaultRtMaterial ) );
+
+				rtMaterial_t& rtMaterial = rtScene.materials.back();
+				if ( rtMaterial.textured )
+				{
+					// Images are kept by handle, so recommits only register new ones
+					const hdl_t textureHdl = rtMaterial.desc.GetTexture( GGX_COLOR_MAP_SLOT );
+					const Asset<Texture>* texture = textureLib->Find( textureHdl );
+					const ImageBuffer<rgba8_t>* image = ( texture != nullptr ) ? reinterpret_cast<const ImageBuffer<rgba8_t>*>( texture->Get().cpuImage ) : nullptr;
+					if ( image != nullptr )
+					{
+						rtMaterial.colorMapIx = rtScene.textures->FindTexture( static_cast<uint64_t>( textureHdl ) );
+						if ( rtMaterial.colorMapIx == InvalidTextureIx )
+						{
+							if ( !ownsTextures )
+							{
+								rtScene.textures = rtScene.textures->Fork();
+								ownsTextures = true;
+							}
+							rtMaterial.colorMapIx = rtScene.textures->AddTexture( *image, static_cast<uint64_t>( textureHdl ) );
+						}
+					}
+					else
+					{
+						rtMaterial.textured = false;
+					}
+				}
+				it = tableIx.insert( std::make_pair( materialId, static_cast<uint16_t>( rtScene.materials.size() - 1 ) ) ).first;
 			}
+			slotMaterials[ slot ] = it->second;
+		}
+	}
+
+	if ( rtScene.materials.empty() ) {
+		rtScene.materials.push_back( MakeRtMaterial( DefaultRtMaterial ) );
+	}
+}
+
+
+inline RtScene& RtSceneBuilder::Stage()
+{
+	// The first edit after a commit starts from the published scene;
+	// later edits in the same frame reuse the staging copy
+	if ( !dirty && snapshot ) {
+		staging = snapshot->Clone();
+	}
+	dirty = true;
+	return staging;
+}
+
+
+inline RtScene& RtSceneBuilder::Edit()
+{
+	rebuild = true;
+	return Stage();
+}
+
+
+inline void RtSceneBuilder::SetInstanceTransform( const uint32_t instanceIx, const mat4x4f& transform )
+{
+	RtScene& rtScene = Stage();
+	assert( instanceIx < rtScene.instances.size() );
+	::SetInstanceTransform( rtScene, rtScene.instances[ instanceIx ], transform );
+}
+
+
+inline RtSceneRef RtSceneBuilder::Commit()
+{
+	if ( dirty )
+	{
+		if ( rebuild )
+		{
+			BuildMaterialTable( staging );
+			staging.lightBvh.Build( staging.lights );
+			BuildSceneBvh( staging );
+		}
+		else
+		{
+			// Materials and lights carried over from the snapshot are still valid
+			RefitSceneBvh( staging );
+		}
+		snapshot = std::make_shared<const RtScene>( std::move( staging ) );
+		staging = RtScene();
+		dirty = false;
+		rebuild = false;
+	}
+	return snapshot;
+}
+
+
+// Blinn-Phong contribution of one unoccluded light
+inline Color ShadeLight( const sample_t& surfaceSample, const rtMaterial_t& material, const Color& surfaceColor, const vec3f& viewVector, const light_t& L, const vec3f& toLight )
+{
+	const vec4f intensity = L.intensity * ColorToVector( L.color );
+
+	const vec3f lightDir = Normalize( toLight );
+	const vec3f halfVector = Normalize( viewVector + lightDir );
+
+	const vec4f diffuseIntensity = Multiply( material.Kd, intensity ) * std::max( 0.0f, Dot( lightDir, surfaceSample.normal ) );
+
+	const vec4f specularIntensity = Multiply( material.Ks, intensity ) * pow( std::max( 0.0f, Dot( surfaceSample.normal, halfVector ) ), material.Ns );
+
+	Color shadingColor = Color::Black;
+	shadingColor += Vec4ToColor( specularIntensity );
+	shadingColor += Vec4ToColor( Multiply( diffuseIntensity, ColorToVector( surfaceColor ) ) );
+	return shadingColor;
+}
+
+
+// Calls onLight( light, weight ) for the lights that shade a surface point.
+// Small light sets are shaded exhaustively. Larger ones draw a few lights
+// from the light hierarchy, weighted by their inverse selection probability.
+template<class LightCallback>
+inline void ForEachLightSample( const RtScene& rtScene, const sample_t& surfaceSample, Sampler& sampler, LightCallback onLight )
+{
+	const size_t lightCnt = rtScene.lights.size();
+	if ( lightCnt <= ExhaustiveLightCnt )
+	{
+		for ( size_t li = 0; li < lightCnt; ++li ) {
+			onLight( rtScene.lights[ li ], 1.0f );
+		}
+		return;
+	}
+
+	for ( uint32_t s = 0; s < LightSamplesPerHit; ++s )
+	{
+		uint32_t lightIx;
+		float pmf;
+		if ( rtScene.lightBvh.Sample( surfaceSample.pt, surfaceSample.normal, sampler.Next1D(), lightIx, pmf ) ) {
+			onLight( rtScene.lights[ lightIx ], 1.0f / ( pmf * LightSamplesPerHit ) );
+		}
+	}
+}
+
+
+template<uint32_t Features>
+inline sample_t RayTrace( const Ray& ray, const RtScene& rtScene, const renderSettings_t& settings, Sampler& sampler )
+{
+	hitRecord_t hit;
+	IntersectScene( ray, rtScene, true, false, hit );
+
+	return TracePath<Features>( ray, hit, rtScene, settings, sampler );
+}
+
+
+// Follows a path from its primary hit. Bounces are taken in a loop with the
+// path's reflectance carried as a throughput weight; the returned sample
+// describes the primary surface and holds the light gathered along the path.
+template<uint32_t Features>
+inline sample_t TracePath( const Ray& primaryRay, const hitRecord_t& primaryHit, const RtScene& rtScene, const renderSettings_t& settings, Sampler& sampler )
+{
+	pathBounce_t bounce;
+	sample_t sample = ShadeHit<Features>( primaryRay, rtScene, settings, primaryHit, sampler, 0, bounce );
+
+	float throughput = 1.0f;
+	for ( uint32_t depth = 1; bounce.weight > 0.0f; ++depth )
+	{
+		throughput *= bounce.weight;
+		if ( !SurvivesRoulette( settings, depth, throughput, sampler ) ) {
+			break;
 		}
+
+		const Ray ray = bounce.ray;
+		hitRecord_t hit;
+		IntersectScene( ray, rtScene, true, false, hit );
+
+		const sample_t vertex = ShadeHit<Features>( ray, rtScene, settings, hit, sampler, depth, bounce );
+		sample.color += throughput * vertex.color;
 	}
 
-	return ( outSample.hitCode != HIT_SKY ) && ( outSample.hitCode != HIT_AABB );
+	return sample;
 }
 
 
-inline sample_t RayTrace_r( const Ray& ray, const RtScene& rtScene, const uint32_t rayDepth )
+// Russian roulette: past settings.rouletteBounces a path survives with
+// probability equal to its throughput, and survivors are reweighted so the
+// estimate stays unbiased.
+inline bool SurvivesRoulette( const renderSettings_t& settings, const uint32_t depth, float& throughput, Sampler& sampler )
 {
-	float tnear = 0;
-	float tfar = 0;
+	if ( depth <= settings.rouletteBounces ) {
+		return true;
+	}
+
+	const float survival = std::min( 1.0f, throughput );
+	if ( sampler.Next1D() >= survival ) {
+		return false;
+	}
+	throughput /= survival;
+	return true;
+}
 
+
+template<uint32_t Features>
+inline sample_t ShadeMiss( const Ray& ray, const hitRecord_t& hit )
+{
 	sample_t sample;
 	sample.color = Color::Black;
 	sample.hitCode = HIT_NONE;
 
-#if USE_AABB
-	if ( !rtScene.aabb.Intersect( ray, tnear, tfar ) )
-	{
+	// Missed the root bounds of the scene hierarchy
+	if ( ( Features & RENDER_AABB ) && ( hit.hitCode == HIT_NONE ) ) {
 		return sample;
 	}
-#endif
+	sample = RecordSkyInfo( ray, hit.t );
+	sample.color = Color::Green;
+	return sample;
+}
 
-	sample_t surfaceSample;
-	if ( !IntersectScene( ray, rtScene, true, false, surfaceSample ) )
-	{
-		sample = RecordSkyInfo( ray, surfaceSample.t );
-		sample.color = Color::Green;
+
+// Shades one path vertex. The sample's color is the light reflected directly
+// toward the ray origin; a reflective surface instead sets outBounce and
+// leaves the rest of the path to the caller.
+template<uint32_t Features>
+inline sample_t ShadeHit( const Ray& ray, const RtScene& rtScene, const renderSettings_t& settings, const hitRecord_t& hit, Sampler& sampler, const uint32_t rayDepth, pathBounce_t& outBounce )
+{
+	outBounce.weight = 0.0f;
+
+	if ( ( hit.hitCode != HIT_FRONTFACE ) && ( hit.hitCode != HIT_BACKFACE ) ) {
+		return ShadeMiss<Features>( ray, hit );
+	}
+
+	sample_t sample = RecordSurfaceInfo<Features>( ray, rtScene, hit );
+	if ( Features & RENDER_RAYCAST ) {
 		return sample;
 	}
-	else
+
+	const sample_t& surfaceSample = sample;
+	const rtMaterial_t& material = rtScene.materials[ surfaceSample.materialIx ];
+	Color surfaceColor = material.textured ? surfaceSample.albedo : surfaceSample.color;
+
+	vec3f viewVector = ray.GetVector().Reverse();
+	viewVector = Normalize( viewVector );
+
+	if ( ( Features & RENDER_REFLECTION ) && ( rayDepth < settings.maxBounces ) && ( material.Tr > 0.0f ) )
 	{
-#if USE_RAYCAST
-		return surfaceSample;
-#endif
-		Color finalColor = Color::Black;
-		const Asset<Material>* material = rtScene.assets->GetLib<Material>()->Find( surfaceSample.materialId );
-		Color surfaceColor = ( material != nullptr && material->Get().IsTextured() ) ? surfaceSample.albedo : surfaceSample.color;
+		vec3f reflectVector = ReflectVector( surfaceSample.normal, viewVector );
+		reflectVector += SampleBall( sampler, 0.1f );
+		reflectVector = MaxT * reflectVector;
 
-		vec3f viewVector = ray.GetVector().Reverse();
-		viewVector = Normalize( viewVector );
+		outBounce.ray = Ray( surfaceSample.pt, surfaceSample.pt + reflectVector );
+		outBounce.weight = material.Tr;
 
-		Color relfectionColor = Color::Black;
-#if USE_RELFECTION
-		if ( ( rayDepth < MaxBounces ) && ( material->Tr > 0.0 ) )
-		{
-			vec3f reflectVector = ReflectVector( surfaceSample.normal, viewVector );
-			reflectVector += RandomVector( 0.1f );
-			reflectVector = MaxT * reflectVector;
+		sample.color = Color::Black;
+		return sample;
+	}
 
-			Ray reflectionRay = Ray( surfaceSample.pt, surfaceSample.pt + reflectVector );
+	Color finalColor = Color::Black;
+	ForEachLightSample( rtScene, surfaceSample, sampler, [&]( const light_t& L, const float weight )
+	{
+		vec3f lightPos = Trunc<4,1>( L.pos );
 
-			const sample_t reflectSample = RayTrace_r( reflectionRay, rtScene, rayDepth + 1 );
-			relfectionColor = material->Tr * reflectSample.color;
+		Ray shadowRay = Ray( surfaceSample.pt, lightPos );
 
-			sample = surfaceSample;
-			sample.color = relfectionColor;
+		bool lightOccluded = false;
+		if ( Features & RENDER_SHADOWS )
+		{
+			// Only occluders between the surface and the light count
+			const traceRay_t shadowTraceRay = MakeTraceRay( shadowRay );
+			const vec3f toLight = lightPos - surfaceSample.pt;
+			const float lightT = Dot( toLight, shadowTraceRay.d ) / Dot( shadowTraceRay.d, shadowTraceRay.d );
+			lightOccluded = Occluded( shadowTraceRay, rtScene, MinT, lightT * ( 1.0f - MinT ) );
+		}
 
-			return sample;
+		if ( !lightOccluded ) {
+			finalColor += weight * ShadeLight( surfaceSample, material, surfaceColor, viewVector, L, shadowRay.GetVector() );
 		}
-#endif
+	} );
 
-		const size_t lightCnt = rtScene.lights.size();
-		for ( size_t li = 0; li < lightCnt; ++li )
-		{
-			const light_t& L = rtScene.lights[ li ];
-			vec3f lightPos = Trunc<4,1>( L.pos );
+	const Color ambient = AmbientLight * Vec4ToColor( Multiply( material.Ka, ColorToVector( surfaceColor ) ) );
 
-			Ray shadowRay = Ray( surfaceSample.pt, lightPos );
+	sample.color = finalColor + ambient;
+	return sample;
+}
 
-			sample_t shadowSample;
-#if USE_SHADOWS
-			const bool lightOccluded = IntersectScene( shadowRay, rtScene, true, true, shadowSample );
+
+inline vec2f SubPixelOffset( Sampler& sampler )
+{
+#if	USE_SSRAND
+	return sampler.Next2D();
+#elif USE_SS4X
+	static const vec2f subPixelOffsets[ SubSampleCnt ] = { vec2f( 0.25, 0.25 ), vec2f( 0.75, 0.25 ), vec2f( 0.25, 0.75 ), vec2f( 0.75, 0.75 ) };
+	return subPixelOffsets[ sampler.GetSampleIndex() ];
 #else
-			const bool lightOccluded = false;
+	return vec2f( 0.5, 0.5 );
 #endif
+}
 
-			Color shadingColor = Color::Black;
-			if ( !lightOccluded )
-			{
-				const vec4f intensity = L.intensity * ColorToVector( L.color );
 
-				vec3f lightDir = shadowRay.GetVector();
-				lightDir = Normalize( lightDir );
+inline void ClearAccum( pixelAccum_t& accum )
+{
+	accum = {};
+	accum.color = Color::Black;
+	accum.albedo = Color::Black;
+	accum.normal = vec3f( 0.0, 0.0, 0.0 );
+	accum.modelIx = ~0u;
+	accum.materialIx = ~0u;
+}
 
-				const vec3f halfVector = Normalize( viewVector + lightDir );
 
-				const vec4f D = ColorToVector( Color( material->Get().Kd() ) );
-				const vec4f S = ColorToVector( Color( material->Get().Ks() ) );
+inline void AccumulateSample( pixelAccum_t& accum, const sample_t& sample )
+{
+	const bool surfaceHit = ( sample.hitCode == HIT_FRONTFACE ) || ( sample.hitCode == HIT_BACKFACE );
+	if ( surfaceHit )
+	{
+		if ( accum.hitCnt == 0 )
+		{
+			accum.modelIx = sample.modelIx;
+			accum.materialIx = sample.materialIx;
+		}
+		accum.t += sample.t;
+		accum.albedo += sample.albedo;
+		++accum.hitCnt;
+	}
+
+	accum.color += sample.color;
+	accum.diffuse += sample.surfaceDot;
+	accum.normal += sample.normal;
+	accum.coverage += sample.hitCode != HIT_NONE ? 1.0f : 0.0f;
+	++accum.sampleCnt;
+}
+
 
-				const vec4f diffuseIntensity = Multiply( D, intensity ) * std::max( 0.0f, Dot( lightDir, surfaceSample.normal ) );
+inline void BeginTile( tileBuffer_t& tile, const vec2i& p0, const vec2i& p1, const uint32_t aovMask )
+{
+	tile.origin = p0;
+	tile.width = static_cast<uint32_t>( std::max( 0, p1[ 0 ] - p0[ 0 ] ) );
+	tile.height = static_cast<uint32_t>( std::max( 0, p1[ 1 ] - p0[ 1 ] ) );
+
+	// Capacity carries over, so a worker stops allocating after its first tile
+	const size_t pixelCnt = static_cast<size_t>( tile.width ) * tile.height;
+	tile.color.resize( pixelCnt );
+	tile.diffuse.resize( pixelCnt );
+	tile.normal.resize( pixelCnt );
+	tile.covered.assign( pixelCnt, 0 );
+
+	tile.aovMask = aovMask;
+	if ( aovMask != 0 ) {
+		tile.aov.resize( AovTotalChannels * pixelCnt );
+	}
+}
 
-				const vec4f specularIntensity = Multiply( S, intensity ) * pow( std::max( 0.0f, Dot( surfaceSample.normal, halfVector ) ), material->Get().Ns() );
 
-				shadingColor += Vec4ToColor( specularIntensity );
-				shadingColor += Vec4ToColor( Multiply( diffuseIntensity, ColorToVector( surfaceColor ) ) );
+// Writes the requested passes of one pixel, including pixels no sample hit
+inline void ResolveAovs( tileBuffer_t& tile, const uint32_t localIx, const pixelAccum_t& accum )
+{
+	const size_t planeSize = static_cast<size_t>( tile.width ) * tile.height;
+	float* planes = tile.aov.data() + localIx;
+
+	const bool surfaceHit = ( accum.hitCnt > 0 );
+	const float hitWeight = surfaceHit ? ( 1.0f / accum.hitCnt ) : 0.0f;
+
+	for ( uint32_t pass = 0; pass < AOV_PASS_COUNT; ++pass )
+	{
+		if ( ( tile.aovMask & ( 1u << pass ) ) == 0 ) {
+			continue;
+		}
+
+		float values[ 3 ] = { AovClearValue[ pass ], AovClearValue[ pass ], AovClearValue[ pass ] };
+		if ( surfaceHit || ( pass == AOV_SAMPLE_COUNT ) )
+		{
+			switch ( pass )
+			{
+			case AOV_DEPTH:
+				values[ 0 ] = hitWeight * accum.t;
+				break;
+			case AOV_NORMAL:
+			{
+				const vec3f normal = Normalize( accum.normal );
+				values[ 0 ] = normal[ 0 ];
+				values[ 1 ] = normal[ 1 ];
+				values[ 2 ] = normal[ 2 ];
+				break;
 			}
+			case AOV_ALBEDO:
+			{
+				const vec4f albedo = ColorToVector( accum.albedo );
+				values[ 0 ] = hitWeight * albedo[ 0 ];
+				values[ 1 ] = hitWeight * albedo[ 1 ];
+				values[ 2 ] = hitWeight * albedo[ 2 ];
+				break;
+			}
+			case AOV_MODEL_ID:
+				values[ 0 ] = static_cast<float>( accum.modelIx );
+				break;
+			case AOV_MATERIAL_ID:
+				values[ 0 ] = static_cast<float>( accum.materialIx );
+				break;
+			case AOV_SAMPLE_COUNT:
+				values[ 0 ] = static_cast<float>( accum.sampleCnt );
+				break;
+			}
+		}
 
-			finalColor += shadingColor + relfectionColor;
+		for ( uint32_t c = 0; c < AovChannelCnt[ pass ]; ++c ) {
+			planes[ ( AovChannelOffset[ pass ] + c ) * planeSize ] = values[ c ];
 		}
+	}
+}
 
-		const Color ambient = AmbientLight * ( Color( material->Get().Ka() ) * surfaceColor );
 
-		sample = surfaceSample;
-		sample.color = finalColor + ambient;
-		return sample;
+inline void ResolvePixel( tileBuffer_t& tile, const uint32_t px, const uint32_t py, const pixelAccum_t& accum )
+{
+	const uint32_t localIx = ( py - tile.origin[ 1 ] ) * tile.width + ( px - tile.origin[ 0 ] );
+	if ( tile.aovMask != 0 ) {
+		ResolveAovs( tile, localIx, accum );
 	}
 
-	return sample;
+	if ( accum.coverage > 0.0 )
+	{
+		const float sampleWeight = 1.0f / accum.sampleCnt;
+		const float coverage = accum.coverage * sampleWeight;
+		const float diffuse = accum.diffuse * sampleWeight;
+		const vec3f normal = Normalize( accum.normal );
+
+		Color src = Color( LinearToSrgb( sampleWeight * accum.color ) );
+		src.a() = (float)coverage;
+
+		tile.color[ localIx ] = src;
+		tile.diffuse[ localIx ] = Color( (float)-diffuse );
+		tile.normal[ localIx ] = Vec4ToColor( vec4f( 0.5f * normal + vec3f( 0.5f ), 1.0f ) );
+		tile.covered[ localIx ] = 1;
+	}
 }
 
 
-inline void TracePixel( const RtView& view, const RtScene& rtScene, ImageBuffer<Color>& image, debug_t& dbg, const uint32_t px, const uint32_t py )
+// Copies a finished tile to the shared images, row by row
+template<uint32_t Features>
+inline void WriteTile( const tileBuffer_t& tile, ImageBuffer<Color>& image, debug_t& dbg )
 {
-#if	USE_SSRAND
-	const uint32_t subSampleCnt = 100;
-	vec2f subPixelOffsets[ subSampleCnt ];
-	for ( uint32_t ri = 0; ri < subSampleCnt; ++ri )
+	const size_t planeSize = static_cast<size_t>( tile.width ) * tile.height;
+	for ( uint32_t pass = 0; pass < AOV_PASS_COUNT; ++pass )
 	{
-		subPixelOffsets[ ri ] = vec2f( Random(), Random() );
+		if ( ( tile.aovMask & ( 1u << pass ) ) == 0 ) {
+			continue;
+		}
+
+		for ( uint32_t c = 0; c < AovChannelCnt[ pass ]; ++c )
+		{
+			const float* src = tile.aov.data() + ( AovChannelOffset[ pass ] + c ) * planeSize;
+			float* dst = dbg.aov.GetPlane( static_cast<aovPass_t>( pass ), c ) + tile.origin[ 1 ] * dbg.aov.GetWidth() + tile.origin[ 0 ];
+			for ( uint32_t y = 0; y < tile.height; ++y ) {
+				std::copy( src + y * tile.width, src + ( y + 1 ) * tile.width, dst + y * dbg.aov.GetWidth() );
+			}
+		}
 	}
-#elif USE_SS4X
-	static const uint32_t subSampleCnt = 4;
-	static const vec2f subPixelOffsets[ subSampleCnt ] = { vec2f( 0.25, 0.25 ), vec2f( 0.75, 0.25 ), vec2f( 0.25, 0.75 ), vec2f( 0.75, 0.75 ) };
-#else
-	static const uint32_t subSampleCnt = 1;
-	static const vec2f subPixelOffsets[ subSampleCnt ] = { vec2f( 0.5, 0.5 ) };
-#endif
 
-	Color pixelColor = Color::Black;
-	vec3f normal = vec3f( 0.0, 0.0, 0.0 );
-	float diffuse = 0.0; // Eye-to-Surface
-	float coverage = 0.0;
-	float t = 0.0;
+	for ( uint32_t y = 0; y < tile.height; ++y )
+	{
+		const int32_t imageY = tile.origin[ 1 ] + static_cast<int32_t>( y );
+		const uint32_t rowIx = y * tile.width;
 
-	sample_t sample;
-	sample.hitCode = HIT_NONE;
+		for ( uint32_t x = 0; x < tile.width; ++x )
+		{
+			const uint32_t localIx = rowIx + x;
+			if ( tile.covered[ localIx ] == 0 ) {
+				continue;
+			}
+
+			const int32_t imageX = tile.origin[ 0 ] + static_cast<int32_t>( x );
+			dbg.diffuse.SetPixel( imageX, imageY, tile.diffuse[ localIx ] );
+			dbg.normal.SetPixel( imageX, imageY, tile.normal[ localIx ] );
 
-	for ( int32_t s = 0; s < subSampleCnt; ++s ) // Subsamples
+			if ( Features & RENDER_RAYCAST )
+			{
+				image.SetPixel( imageX, imageY, tile.color[ localIx ] );
+			}
+			else
+			{
+				const Color dest = Color( image.GetPixel( imageX, imageY ) );
+				image.SetPixel( imageX, imageY, BlendColor( tile.color[ localIx ], dest, blendMode_t::SRCALPHA ) );
+			}
+		}
+	}
+}
+
+
+inline Ray GetPixelRay( const RtView& view, const uint32_t px, const uint32_t py, const vec2f& subPixelOffset )
+{
+	vec2f pixelXY = vec2f( static_cast<float>( px ), static_cast<float>( py ) );
+	pixelXY += subPixelOffset;
+	vec2f uv = vec2f( pixelXY[ 0 ] / ( view.targetSize[ 0 ] - 1.0f ), pixelXY[ 1 ] / ( view.targetSize[ 1 ] - 1.0f ) );
+
+	return view.camera.GetViewRay( uv );
+}
+
+
+template<uint32_t Features>
+inline void TracePixel( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile, const uint32_t px, const uint32_t py )
+{
+	pixelAccum_t accum;
+	ClearAccum( accum );
+
+	Sampler sampler( SamplerSeed, px, py );
+	for ( uint32_t s = 0; s < SubSampleCnt; ++s ) // Subsamples
 	{
-		vec2f pixelXY = vec2f( static_cast<float>( px ), static_cast<float>( py ) );
-		pixelXY += subPixelOffsets[ s ];
-		vec2f uv = vec2f( pixelXY[ 0 ] / ( view.targetSize[ 0 ] - 1.0f ), pixelXY[ 1 ] / ( view.targetSize[ 1 ] - 1.0f ) );
+		sampler.StartSample( s );
+		const Ray ray = GetPixelRay( view, px, py, SubPixelOffset( sampler ) );
 
-		Ray ray = view.camera.GetViewRay( uv );
+		const sample_t sample = RayTrace<Features>( ray, rtScene, settings, sampler );
+		AccumulateSample( accum, sample );
+	}
 
-		sample = RayTrace_r( ray, rtScene, 0 );
-		pixelColor += sample.color;
-		diffuse += sample.surfaceDot;
-		normal += sample.normal;
-		t += sample.t;
-		coverage += sample.hitCode != HIT_NONE ? 1.0f : 0.0f;
+	ResolvePixel( tile, px, py, accum );
+}
+
+
+// Traces the primary rays of a block of up to PacketWidth x PacketWidth pixels together
+template<uint32_t Features>
+inline void TracePacket( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile, const vec2i& p0, const vec2i& p1 )
+{
+	const uint32_t width = static_cast<uint32_t>( p1[ 0 ] - p0[ 0 ] );
+	const uint32_t height = static_cast<uint32_t>( p1[ 1 ] - p0[ 1 ] );
+	assert( ( width <= PacketWidth ) && ( height <= PacketWidth ) );
+
+	pixelAccum_t accum[ PacketRayCnt ];
+	Sampler samplers[ PacketRayCnt ];
+	for ( uint32_t r = 0; r < PacketRayCnt; ++r )
+	{
+		ClearAccum( accum[ r ] );
+		samplers[ r ] = Sampler( SamplerSeed, p0[ 0 ] + ( r % width ), p0[ 1 ] + ( r / width ) );
 	}
 
-	if ( coverage > 0.0 )
+	for ( uint32_t s = 0; s < SubSampleCnt; ++s ) // Subsamples
 	{
-		int32_t imageX = static_cast<int32_t>( px );
-		int32_t imageY = static_cast<int32_t>( py );
+		Ray rays[ PacketRayCnt ];
+		rayPacket_t packet;
+		packet.rayCnt = width * height;
 
-		coverage /= subSampleCnt;
-		diffuse /= subSampleCnt;
-		normal = Normalize( normal );
-		t /= subSampleCnt;
+		for ( uint32_t r = 0; r < packet.rayCnt; ++r )
+		{
+			const uint32_t px = p0[ 0 ] + ( r % width );
+			const uint32_t py = p0[ 1 ] + ( r / width );
+			samplers[ r ].StartSample( s );
+			rays[ r ] = GetPixelRay( view, px, py, SubPixelOffset( samplers[ r ] ) );
+			packet.rays[ r ] = MakeTraceRay( rays[ r ] );
+		}
+		FinalizePacket( packet );
 
-		Color src = Color( LinearToSrgb( ( 1.0f / subSampleCnt ) * pixelColor ) );
-		src.a() = (float)coverage;
+		hitRecord_t hits[ PacketRayCnt ];
+		IntersectScenePacket( packet, rtScene, true, hits );
 
-		Color normColor = Vec4ToColor( vec4f( 0.5f * normal + vec3f( 0.5f ), 1.0f ) );
-		dbg.diffuse.SetPixel( imageX, imageY, Color( (float)-diffuse ).AsHex() );
-		dbg.normal.SetPixel( imageX, imageY, normColor.AsHex() );
+		for ( uint32_t r = 0; r < packet.rayCnt; ++r )
+		{
+			const sample_t sample = TracePath<Features>( rays[ r ], hits[ r ], rtScene, settings, samplers[ r ] );
+			AccumulateSample( accum[ r ], sample );
+		}
+	}
 
-#if USE_RAYCAST
-		image.SetPixel( imageX, imageY, src.AsHex() );
-#else
-		Color dest = Color( image.GetPixel( imageX, imageY ) );
+	for ( uint32_t r = 0; r < width * height; ++r ) {
+		ResolvePixel( tile, p0[ 0 ] + ( r % width ), p0[ 1 ] + ( r / width ), accum[ r ] );
+	}
+}
 
-		Color pixel = BlendColor( src, dest, blendMode_t::SRCALPHA );
-		image.SetPixel( imageX, imageY, pixel );
-#endif
+
+// Traces every pixel of a tile prepared by BeginTile() into the tile itself
+template<uint32_t Features>
+inline void TraceTileBuffer( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, tileBuffer_t& tile )
+{
+	const uint32_t x0 = tile.origin[ 0 ];
+	const uint32_t y0 = tile.origin[ 1 ];
+	const uint32_t xEnd = x0 + tile.width;
+	const uint32_t yEnd = y0 + tile.height;
+
+#if USE_PACKETS
+	for ( uint32_t py = y0; py < yEnd; py += PacketWidth )
+	{
+		for ( uint32_t px = x0; px < xEnd; px += PacketWidth )
+		{
+			const vec2i packetEnd = vec2i( std::min( px + PacketWidth, xEnd ), std::min( py + PacketWidth, yEnd ) );
+			TracePacket<Features>( view, rtScene, settings, tile, vec2i( px, py ), packetEnd );
+		}
+	}
+#else
+	for ( uint32_t py = y0; py < yEnd; ++py )
+	{
+		for ( uint32_t px = x0; px < xEnd; ++px ) {
+			TracePixel<Features>( view, rtScene, settings, tile, px, py );
+		}
 	}
+#endif
 }
 
 
-inline void TracePatch( const RtView& view, const RtScene& rtScene, ImageBuffer<Color>* image, debug_t* dbg, const vec2i& p0, const vec2i& p1 )
+template<uint32_t Features>
+inline void TracePatch( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>* image, debug_t* dbg, const vec2i& p0, const vec2i& p1 )
 {
 	const int32_t x0 = p0[ 0 ];
 	const int32_t y0 = p0[ 1 ];
@@ -407,51 +1392,59 @@ inline void TracePatch( const RtView& view, const RtScene& rtScene, ImageBuffer<
 		return;
 	}
 
-	for ( uint32_t py = y0; py < static_cast<uint32_t>( y1 ); ++py )
-	{
-		if ( py >= image->GetHeight() )
-			return;
+	const uint32_t xEnd = std::min( static_cast<uint32_t>( x1 ), image->GetWidth() );
+	const uint32_t yEnd = std::min( static_cast<uint32_t>( y1 ), image->GetHeight() );
+	if ( ( xEnd <= static_cast<uint32_t>( x0 ) ) || ( yEnd <= static_cast<uint32_t>( y0 ) ) ) {
+		return;
+	}
 
-		for ( uint32_t px = x0; px < static_cast<uint32_t>( x1 ); ++px )
-		{
-			if ( px >= image->GetWidth() )
-				return;
+	thread_local tileBuffer_t tile;
+	BeginTile( tile, p0, vec2i( xEnd, yEnd ), dbg->aov.GetPassMask() );
+	TraceTileBuffer<Features>( view, rtScene, settings, tile );
 
-			TracePixel( view, rtScene, *image, *dbg, px, py );
-		}
-	}
+	WriteTile<Features>( tile, *image, *dbg );
 }
 
 
-inline void TraceScene( const RtView& view, const RtScene& rtScene, ImageBuffer<Color>& image, debug_t& dbg )
+inline void TraceScene( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg )
 {
 #if USE_RAYTRACE
-	uint32_t threadsLaunched = 0;
-	uint32_t threadsComplete = 0;
-	std::vector<std::thread> threads;
+	const tracePatchKernel_t TracePatchKernel = SelectKernel<TracePatchKernels>( GetRenderFeatures( settings ) );
+
+	const uint32_t renderWidth = view.targetSize[ 0 ];
+	const uint32_t renderHeight = view.targetSize[ 1 ];
+	dbg.aov.Init( settings.aovMask, renderWidth, renderHeight );
 
-	uint32_t renderWidth = view.targetSize[ 0 ];
-	uint32_t renderHeight = view.targetSize[ 1 ];
+	// Small tiles keep the queues deep enough for idle workers to steal from
+	const uint32_t tileSize = 4 * PacketWidth;
+	const uint32_t tileCnt = ( ( renderWidth + tileSize - 1 ) / tileSize ) * ( ( renderHeight + tileSize - 1 ) / tileSize );
 
-	const uint32_t patchSize = 120;
-	for ( uint32_t py = 0; py < renderHeight; py += patchSize )
+	std::atomic<uint32_t> tilesComplete( 0 );
+	std::mutex printLock;
+	uint32_t lastPercent = 0;
+
+	for ( uint32_t py = 0; py < renderHeight; py += tileSize )
 	{
-		for ( uint32_t px = 0; px < renderWidth; px += patchSize )
+		for ( uint32_t px = 0; px < renderWidth; px += tileSize )
 		{
-			vec2i patch;
-			patch[ 0 ] = Clamp( px + patchSize, px, renderWidth );
-			patch[ 1 ] = Clamp( py + patchSize, py, renderHeight );
+			const vec2i p0 = vec2i( px, py );
+			const vec2i p1 = vec2i( Clamp( px + tileSize, px, renderWidth ), Clamp( py + tileSize, py, renderHeight ) );
+
+			pool.Submit( [ &, p0, p1 ]()
+			{
+				TracePatchKernel( view, rtScene, settings, &image, &dbg, p0, p1 );
 
-			threads.push_back( std::thread( TracePatch, view, rtScene, &image, &dbg, vec2i( px, py ), patch ) );
-			++threadsLaunched;
+				const uint32_t percent = static_cast<uint32_t>( 100.0 * ( ++tilesComplete / (float)tileCnt ) );
+
+				std::lock_guard<std::mutex> guard( printLock );
+				if ( percent >= ( lastPercent + 10 ) ) {
+					lastPercent = percent - ( percent % 10 );
+					std::cout << lastPercent << "% ";
+				}
+			} );
 		}
 	}
 
-	for ( auto& thread : threads )
-	{
-		thread.join(); // TODO: replace with non-blocking call for better messaging
-		++threadsComplete;
-		std::cout << static_cast<int>( 100.0 * ( threadsComplete / (float)threadsLaunched ) ) << "% ";
-	}
+	pool.Wait();
 #endif
 }
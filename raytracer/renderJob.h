@@ -0,0 +1,396 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// renderJob.h — Asynchronous, deadline-bounded trace
+//
+// Requires: raytrace.h
+//
+// Start() queues the frame on the pool and returns straight away; Poll()
+// reports per-tile progress and Cancel() stops tiles that have not begun.
+// With a deadline every tile is traced twice: a raycast preview into a
+// job-owned image, then the full-quality pass into the target. The preview
+// covers the whole frame before any full pass starts and ignores the
+// deadline, so tiles whose full pass did not run in time always have it to
+// fall back on. Without a deadline only the full pass runs.
+// With settings.denoise the finished frame is filtered as a last step,
+// one pass of row bands at a time, before the job reports done.
+//
+
+#include "raytrace.h"
+#include "denoise.h"
+#include <chrono>
+
+
+enum renderJobState_t : uint32_t
+{
+	JOB_IDLE,
+	JOB_RUNNING,
+	JOB_FINISHED,
+	JOB_CANCELLED,
+	JOB_TIMED_OUT,		// Finished with some tiles at preview quality
+};
+
+
+struct renderProgress_t
+{
+	renderJobState_t	state;
+	uint32_t			tileCnt;
+	uint32_t			previewTiles;	// Tiles with at least the preview done, or the full pass without a deadline
+	uint32_t			finalTiles;		// Tiles at full quality
+	double				elapsedMs;
+};
+
+
+// Tiles are traced by pool workers that reference the job, so it must stay
+// in place, along with the target image and debug buffers, until Poll()
+// stops reporting JOB_RUNNING. The destructor cancels and waits.
+class RenderJob
+{
+public:
+	explicit RenderJob( ThreadPool& pool );
+	~RenderJob();
+
+	RenderJob( const RenderJob& ) = delete;
+	RenderJob& operator=( const RenderJob& ) = delete;
+
+	// deadlineMs of 0 means no deadline. Fails if the job is still running.
+	bool				Start( const RtView& view, const RtSceneRef& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, const double deadlineMs = 0.0 );
+	renderProgress_t	Poll() const;
+	void				Cancel();
+	void				Wait();
+
+private:
+	typedef std::chrono::steady_clock clock_t;
+
+	enum tileState_t : uint8_t
+	{
+		TILE_PENDING,
+		TILE_PREVIEW,
+		TILE_FINAL,
+	};
+
+	bool				CanStartTile() const;
+	void				RunPreview( const uint32_t tileIx );
+	void				QueueFinals();
+	void				RunFinal( const uint32_t tileIx );
+	void				FinishTile();
+	void				Finish();
+	void				QueueDenoisePass( const uint32_t pass );
+	void				RunDenoiseBand( const uint32_t pass, const uint32_t band );
+	void				Complete();
+	double				GetElapsedMs() const;
+
+	ThreadPool&					pool;
+	RtView						view;
+	RtSceneRef					rtScene;
+	renderSettings_t			settings;
+	ImageBuffer<Color>*			image;
+	debug_t*					dbg;
+	ImageBuffer<Color>			preview;
+	Denoiser					denoiser;
+
+	tracePatchKernel_t			previewKernel;
+	tracePatchKernel_t			finalKernel;
+
+	std::vector<vec2i>			tileOrigins;
+	std::vector<uint8_t>		tileStates;		// tileState_t, read once every tile has finished
+	uint32_t					tileSize;
+
+	clock_t::time_point			startTime;
+	double						deadlineMs;
+
+	std::atomic<uint32_t>		state;
+	std::atomic<uint32_t>		remainingPreviews;
+	std::atomic<uint32_t>		remainingTiles;
+	std::atomic<uint32_t>		previewTiles;
+	std::atomic<uint32_t>		finalTiles;
+	std::atomic<uint32_t>		remainingBands;
+	std::atomic<bool>			cancelled;
+};
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline RenderJob::RenderJob( ThreadPool& pool )
+	: pool( pool ), image( nullptr ), dbg( nullptr ), previewKernel( nullptr ), finalKernel( nullptr ), tileSize( 4 * PacketWidth ), deadlineMs( 0.0 ),
+	state( JOB_IDLE ), remainingPreviews( 0 ), remainingTiles( 0 ), previewTiles( 0 ), finalTiles( 0 ), remainingBands( 0 ), cancelled( false )
+{
+}
+
+
+inline RenderJob::~RenderJob()
+{
+	Cancel();
+	Wait();
+}
+
+
+inline bool RenderJob::Start( const RtView& view, const RtSceneRef& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, const double deadlineMs )
+{
+	if ( state == JOB_RUNNING ) {
+		return false;
+	}
+
+	this->view = view;
+	this->rtScene = rtScene;
+	this->settings = settings;
+	this->image = &image;
+	this->dbg = &dbg;
+	this->deadlineMs = deadlineMs;
+
+	// The denoiser needs its guides whatever passes were asked for
+	if ( settings.denoise ) {
+		this->settings.aovMask |= DenoiseGuideMask;
+	}
+
+	// Only the primary hit is shaded for the preview; passes still come out
+	renderSettings_t previewSettings = settings;
+	previewSettings.shadows = false;
+	previewSettings.reflection = false;
+	previewSettings.raycast = true;
+
+	previewKernel = SelectKernel<TracePatchKernels>( GetRenderFeatures( previewSettings ) );
+	finalKernel = SelectKernel<TracePatchKernels>( GetRenderFeatures( settings ) );
+
+	const uint32_t renderWidth = view.targetSize[ 0 ];
+	const uint32_t renderHeight = view.targetSize[ 1 ];
+	dbg.aov.Init( this->settings.aovMask, renderWidth, renderHeight );
+	if ( deadlineMs > 0.0 ) {
+		preview = image;
+	}
+
+	tileOrigins.clear();
+	for ( uint32_t py = 0; py < renderHeight; py += tileSize )
+	{
+		for ( uint32_t px = 0; px < renderWidth; px += tileSize ) {
+			tileOrigins.push_back( vec2i( px, py ) );
+		}
+	}
+	tileStates.assign( tileOrigins.size(), TILE_PENDING );
+
+	const uint32_t tileCnt = static_cast<uint32_t>( tileOrigins.size() );
+	remainingPreviews = tileCnt;
+	remainingTiles = tileCnt;
+	previewTiles = 0;
+	finalTiles = 0;
+	cancelled = false;
+	startTime = clock_t::now();
+	state = JOB_RUNNING;
+
+	if ( tileCnt == 0 )
+	{
+		Finish();
+		return true;
+	}
+
+	// Previews only pay off when the full pass may not finish in time
+	if ( deadlineMs > 0.0 )
+	{
+		for ( uint32_t tileIx = 0; tileIx < tileCnt; ++tileIx ) {
+			pool.Submit( [this, tileIx]() { RunPreview( tileIx ); } );
+		}
+	}
+	else
+	{
+		QueueFinals();
+	}
+	return true;
+}
+
+
+inline renderProgress_t RenderJob::Poll() const
+{
+	renderProgress_t progress;
+	progress.state = static_cast<renderJobState_t>( state.load() );
+	progress.tileCnt = static_cast<uint32_t>( tileOrigins.size() );
+	progress.previewTiles = previewTiles;
+	progress.finalTiles = finalTiles;
+	progress.elapsedMs = GetElapsedMs();
+	return progress;
+}
+
+
+inline void RenderJob::Cancel()
+{
+	cancelled = true;
+}
+
+
+inline void RenderJob::Wait()
+{
+	// Tiles queue their full pass from inside the pool, so keep helping until the job is done
+	while ( state == JOB_RUNNING ) {
+		pool.Wait();
+	}
+}
+
+
+inline double RenderJob::GetElapsedMs() const
+{
+	return std::chrono::duration<double, std::milli>( clock_t::now() - startTime ).count();
+}
+
+
+inline bool RenderJob::CanStartTile() const
+{
+	if ( cancelled ) {
+		return false;
+	}
+	return ( deadlineMs <= 0.0 ) || ( GetElapsedMs() < deadlineMs );
+}
+
+
+// The preview is the fallback for a late tile, so only a cancel skips it
+inline void RenderJob::RunPreview( const uint32_t tileIx )
+{
+	if ( !cancelled )
+	{
+		const vec2i p0 = tileOrigins[ tileIx ];
+		const vec2i p1 = vec2i( std::min( p0[ 0 ] + static_cast<int32_t>( tileSize ), view.targetSize[ 0 ] ), std::min( p0[ 1 ] + static_cast<int32_t>( tileSize ), view.targetSize[ 1 ] ) );
+		previewKernel( view, *rtScene, settings, &preview, dbg, p0, p1 );
+
+		tileStates[ tileIx ] = TILE_PREVIEW;
+		++previewTiles;
+	}
+
+	// Workers pop their own queue newest first, so full passes queued
+	// per tile would run between previews. The last preview queues them all.
+	if ( --remainingPreviews == 0 ) {
+		QueueFinals();
+	}
+}
+
+
+inline void RenderJob::QueueFinals()
+{
+	const uint32_t tileCnt = static_cast<uint32_t>( tileOrigins.size() );
+	for ( uint32_t tileIx = 0; tileIx < tileCnt; ++tileIx ) {
+		pool.Submit( [this, tileIx]() { RunFinal( tileIx ); } );
+	}
+}
+
+
+inline void RenderJob::RunFinal( const uint32_t tileIx )
+{
+	if ( CanStartTile() )
+	{
+		const vec2i p0 = tileOrigins[ tileIx ];
+		const vec2i p1 = vec2i( std::min( p0[ 0 ] + static_cast<int32_t>( tileSize ), view.targetSize[ 0 ] ), std::min( p0[ 1 ] + static_cast<int32_t>( tileSize ), view.targetSize[ 1 ] ) );
+		finalKernel( view, *rtScene, settings, image, dbg, p0, p1 );
+
+		if ( tileStates[ tileIx ] == TILE_PENDING ) {
+			++previewTiles;
+		}
+		tileStates[ tileIx ] = TILE_FINAL;
+		++finalTiles;
+	}
+	FinishTile();
+}
+
+
+inline void RenderJob::FinishTile()
+{
+	if ( --remainingTiles == 0 ) {
+		Finish();
+	}
+}
+
+
+// Runs once, on whichever thread completed the last tile
+inline void RenderJob::Finish()
+{
+	const uint32_t tileCnt = static_cast<uint32_t>( tileOrigins.size() );
+	const uint32_t renderWidth = image->GetWidth();
+	const uint32_t renderHeight = image->GetHeight();
+
+	for ( uint32_t tileIx = 0; tileIx < tileCnt; ++tileIx )
+	{
+		if ( tileStates[ tileIx ] != TILE_PREVIEW ) {
+			continue;
+		}
+
+		const vec2i p0 = tileOrigins[ tileIx ];
+		const uint32_t xEnd = std::min( p0[ 0 ] + tileSize, renderWidth );
+		const uint32_t yEnd = std::min( p0[ 1 ] + tileSize, renderHeight );
+		for ( uint32_t y = p0[ 1 ]; y < yEnd; ++y )
+		{
+			for ( uint32_t x = p0[ 0 ]; x < xEnd; ++x ) {
+				image->SetPixel( x, y, preview.GetPixel( x, y ) );
+			}
+		}
+	}
+
+	if ( settings.denoise && denoiser.Begin( *image, dbg->aov, DefaultDenoiseSettings() ) )
+	{
+		QueueDenoisePass( 0 );
+		return;
+	}
+	Complete();
+}
+
+
+// Each pass reads the whole output of the one before, so the last band
+// of a pass queues the next
+inline void RenderJob::QueueDenoisePass( const uint32_t pass )
+{
+	if ( cancelled || ( pass == denoiser.GetPassCount() ) )
+	{
+		if ( !cancelled ) {
+			denoiser.End( *image );
+		}
+		Complete();
+		return;
+	}
+
+	const uint32_t bandCnt = denoiser.GetBandCount();
+	remainingBands = bandCnt;
+	for ( uint32_t band = 0; band < bandCnt; ++band ) {
+		pool.Submit( [this, pass, band]() { RunDenoiseBand( pass, band ); } );
+	}
+}
+
+
+inline void RenderJob::RunDenoiseBand( const uint32_t pass, const uint32_t band )
+{
+	denoiser.FilterBand( pass, band );
+	if ( --remainingBands == 0 ) {
+		QueueDenoisePass( pass + 1 );
+	}
+}
+
+
+inline void RenderJob::Complete()
+{
+	const uint32_t tileCnt = static_cast<uint32_t>( tileOrigins.size() );
+
+	renderJobState_t finalState = JOB_FINISHED;
+	if ( finalTiles != tileCnt ) {
+		finalState = cancelled ? JOB_CANCELLED : JOB_TIMED_OUT;
+	}
+	state = finalState;
+}
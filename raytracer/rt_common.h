@@ -45,6 +45,8 @@
 #include <cstdint>
 #include <tuple>
 #include <vector>
+#include <memory>
+#include <utility>
 
 // ============================================================
 // GfxCore dependencies
@@ -67,22 +69,33 @@
 #include <gfxcore/asset_types/texture.h>
 #include <gfxcore/asset_types/material.h>
 
+#include "bvh.h"
+#include "triBlock.h"
+#include "triAttrib.h"
+#include "sampler.h"
+#include "textureCache.h"
+#include "lightBvh.h"
+#include "aov.h"
+
 
 // ============================================================
 // Configuration
 // ============================================================
 
-#define USE_AABB		1
-#define USE_RELFECTION	0
-#define USE_SHADOWS		0
 #define USE_RAYTRACE	1
-#define USE_RAYCAST		0
 #define USE_SSRAND		0
 #define USE_SS4X		0
 #define USE_RASTERIZE	1
 #define DRAW_WIREFRAME	1
 #define DRAW_AABB		1
-#define PHONG_NORMALS	1
+#define USE_PACKETS		1
+#define USE_WAVEFRONT	0
+#define USE_ADAPTIVE	1
+#define USE_DISTRIBUTED	0
+#define USE_DENOISE		0
+#define USE_HYBRID		0
+
+static const char*		RenderSocketPath	= "raytracer.sock";
 
 #if 0
 static const uint32_t	RenderWidth			= 1920;
@@ -106,8 +119,107 @@ static const vec2i		RenderSize			= vec2i( RenderWidth, RenderHeight );
 
 static const float		AmbientLight		= 0.1f;
 static const float		SpecularPower		= 15.0f;
+static const float		MinT				= 0.0001f;
 static const float		MaxT				= 1000.0f;
-static const uint32_t	MaxBounces			= 3;
+static const uint32_t	MaxBounces			= 3;		// Default for renderSettings_t::maxBounces
+static const uint32_t	RouletteBounces		= 2;		// Default for renderSettings_t::rouletteBounces
+static const uint32_t	SamplerSeed			= 0x5eed;
+static const uint32_t	ExhaustiveLightCnt	= 4;		// More lights than this are sampled through the light hierarchy
+static const uint32_t	LightSamplesPerHit	= 2;
+
+#if USE_SSRAND
+static const uint32_t	SubSampleCnt		= 100;
+#elif USE_SS4X
+static const uint32_t	SubSampleCnt		= 4;
+#else
+static const uint32_t	SubSampleCnt		= 1;
+#endif
+
+
+// ============================================================
+// Render settings
+// ============================================================
+
+// Trace features picked per render job. Every combination is compiled into
+// its own kernel (see SelectKernel), so per-ray code never tests them.
+enum renderFeature_t : uint32_t
+{
+	RENDER_SHADOWS			= ( 1 << 0 ),
+	RENDER_REFLECTION		= ( 1 << 1 ),
+	RENDER_RAYCAST			= ( 1 << 2 ),	// Unlit surface color only
+	RENDER_AABB				= ( 1 << 3 ),	// Rays missing the scene bounds leave the pixel uncovered
+	RENDER_PHONG_NORMALS	= ( 1 << 4 ),
+};
+
+static const uint32_t	RenderFeatureCombos	= ( 1 << 5 );
+
+struct renderSettings_t
+{
+	bool		shadows;
+	bool		reflection;
+	bool		raycast;
+	bool		aabb;
+	bool		phongNormals;
+	uint32_t	maxBounces;			// Reflection bounces after the primary hit
+	uint32_t	rouletteBounces;	// Bounces before Russian roulette may end a path
+	uint32_t	aovMask;			// aovPassBit_t passes written to debug_t::aov
+	bool		denoise;			// Filter the finished frame, needs DenoiseGuideMask in aovMask
+};
+
+
+inline renderSettings_t FinalRenderSettings()
+{
+	renderSettings_t settings;
+	settings.shadows = false;
+	settings.reflection = false;
+	settings.raycast = false;
+	settings.aabb = true;
+	settings.phongNormals = true;
+	settings.maxBounces = MaxBounces;
+	settings.rouletteBounces = RouletteBounces;
+	settings.denoise = ( USE_DENOISE != 0 );
+	settings.aovMask = settings.denoise ? DenoiseGuideMask : 0;
+	return settings;
+}
+
+
+inline renderSettings_t PreviewRenderSettings()
+{
+	renderSettings_t settings = FinalRenderSettings();
+	settings.shadows = false;
+	settings.reflection = false;
+	settings.raycast = true;
+	return settings;
+}
+
+
+inline uint32_t GetRenderFeatures( const renderSettings_t& settings )
+{
+	uint32_t features = 0;
+	features |= settings.shadows ? RENDER_SHADOWS : 0;
+	features |= settings.reflection ? RENDER_REFLECTION : 0;
+	features |= settings.raycast ? RENDER_RAYCAST : 0;
+	features |= settings.aabb ? RENDER_AABB : 0;
+	features |= settings.phongNormals ? RENDER_PHONG_NORMALS : 0;
+	return features;
+}
+
+
+// Returns Family::Run<features> from a table holding one instantiation per
+// feature combination. Family provides kernel_t and a static Run template.
+template<class Family, uint32_t... Features>
+inline typename Family::kernel_t SelectKernel( const uint32_t features, std::integer_sequence<uint32_t, Features...> )
+{
+	static const typename Family::kernel_t kernels[] = { &Family::template Run<Features>... };
+	return kernels[ features ];
+}
+
+
+template<class Family>
+inline typename Family::kernel_t SelectKernel( const uint32_t features )
+{
+	return SelectKernel<Family>( features, std::make_integer_sequence<uint32_t, RenderFeatureCombos>() );
+}
 
 
 // ============================================================
@@ -140,6 +252,7 @@ struct debug_t
 	ImageBuffer<Color> wireframe;
 	ImageBuffer<Color> topWire;
 	ImageBuffer<Color> sideWire;
+	AovBuffers aov;
 };
 
 static const Color DbgColors[ 16 ] =
@@ -180,21 +293,193 @@ inline void OrthoMatrixToAxis( const mat4x4f& m, vec3f& origin, vec3f& xAxis, ve
 	zAxis = vec3f( m[ 0 ][ 2 ], m[ 1 ][ 2 ], m[ 2 ][ 2 ] );
 }
 
+inline vec3f TransformPoint( const mat4x4f& m, const vec3f& p )
+{
+	return vec3f(	m[ 0 ][ 0 ] * p[ 0 ] + m[ 0 ][ 1 ] * p[ 1 ] + m[ 0 ][ 2 ] * p[ 2 ] + m[ 0 ][ 3 ],
+					m[ 1 ][ 0 ] * p[ 0 ] + m[ 1 ][ 1 ] * p[ 1 ] + m[ 1 ][ 2 ] * p[ 2 ] + m[ 1 ][ 3 ],
+					m[ 2 ][ 0 ] * p[ 0 ] + m[ 2 ][ 1 ] * p[ 1 ] + m[ 2 ][ 2 ] * p[ 2 ] + m[ 2 ][ 3 ] );
+}
+
+inline vec3f TransformVector( const mat4x4f& m, const vec3f& v )
+{
+	return vec3f(	m[ 0 ][ 0 ] * v[ 0 ] + m[ 0 ][ 1 ] * v[ 1 ] + m[ 0 ][ 2 ] * v[ 2 ],
+					m[ 1 ][ 0 ] * v[ 0 ] + m[ 1 ][ 1 ] * v[ 1 ] + m[ 1 ][ 2 ] * v[ 2 ],
+					m[ 2 ][ 0 ] * v[ 0 ] + m[ 2 ][ 1 ] * v[ 1 ] + m[ 2 ][ 2 ] * v[ 2 ] );
+}
+
+// Transforms a normal by the transpose of an inverse matrix
+inline vec3f TransformNormal( const mat4x4f& invM, const vec3f& n )
+{
+	return vec3f(	invM[ 0 ][ 0 ] * n[ 0 ] + invM[ 1 ][ 0 ] * n[ 1 ] + invM[ 2 ][ 0 ] * n[ 2 ],
+					invM[ 0 ][ 1 ] * n[ 0 ] + invM[ 1 ][ 1 ] * n[ 1 ] + invM[ 2 ][ 1 ] * n[ 2 ],
+					invM[ 0 ][ 2 ] * n[ 0 ] + invM[ 1 ][ 2 ] * n[ 1 ] + invM[ 2 ][ 2 ] * n[ 2 ] );
+}
+
+// Inverse of a matrix with an affine bottom row (scale, rotation, translation)
+inline mat4x4f AffineInverse( const mat4x4f& m )
+{
+	const float c00 = m[ 1 ][ 1 ] * m[ 2 ][ 2 ] - m[ 1 ][ 2 ] * m[ 2 ][ 1 ];
+	const float c01 = m[ 1 ][ 2 ] * m[ 2 ][ 0 ] - m[ 1 ][ 0 ] * m[ 2 ][ 2 ];
+	const float c02 = m[ 1 ][ 0 ] * m[ 2 ][ 1 ] - m[ 1 ][ 1 ] * m[ 2 ][ 0 ];
+	const float det = m[ 0 ][ 0 ] * c00 + m[ 0 ][ 1 ] * c01 + m[ 0 ][ 2 ] * c02;
+	const float invDet = ( fabs( det ) > FLT_MIN ) ? ( 1.0f / det ) : 0.0f;
+
+	mat4x4f inv;
+	inv[ 0 ][ 0 ] = c00 * invDet;
+	inv[ 0 ][ 1 ] = ( m[ 0 ][ 2 ] * m[ 2 ][ 1 ] - m[ 0 ][ 1 ] * m[ 2 ][ 2 ] ) * invDet;
+	inv[ 0 ][ 2 ] = ( m[ 0 ][ 1 ] * m[ 1 ][ 2 ] - m[ 0 ][ 2 ] * m[ 1 ][ 1 ] ) * invDet;
+	inv[ 1 ][ 0 ] = c01 * invDet;
+	inv[ 1 ][ 1 ] = ( m[ 0 ][ 0 ] * m[ 2 ][ 2 ] - m[ 0 ][ 2 ] * m[ 2 ][ 0 ] ) * invDet;
+	inv[ 1 ][ 2 ] = ( m[ 0 ][ 2 ] * m[ 1 ][ 0 ] - m[ 0 ][ 0 ] * m[ 1 ][ 2 ] ) * invDet;
+	inv[ 2 ][ 0 ] = c02 * invDet;
+	inv[ 2 ][ 1 ] = ( m[ 0 ][ 1 ] * m[ 2 ][ 0 ] - m[ 0 ][ 0 ] * m[ 2 ][ 1 ] ) * invDet;
+	inv[ 2 ][ 2 ] = ( m[ 0 ][ 0 ] * m[ 1 ][ 1 ] - m[ 0 ][ 1 ] * m[ 1 ][ 0 ] ) * invDet;
+
+	const vec3f t = vec3f( m[ 0 ][ 3 ], m[ 1 ][ 3 ], m[ 2 ][ 3 ] );
+	const vec3f invT = TransformVector( inv, t );
+	inv[ 0 ][ 3 ] = -invT[ 0 ];
+	inv[ 1 ][ 3 ] = -invT[ 1 ];
+	inv[ 2 ][ 3 ] = -invT[ 2 ];
+
+	inv[ 3 ][ 0 ] = 0.0f;
+	inv[ 3 ][ 1 ] = 0.0f;
+	inv[ 3 ][ 2 ] = 0.0f;
+	inv[ 3 ][ 3 ] = 1.0f;
+
+	return inv;
+}
+
+inline AABB TransformBounds( const mat4x4f& m, const AABB& bounds )
+{
+	AABB outBounds;
+	for ( uint32_t i = 0; i < 8; ++i )
+	{
+		const vec3f corner = vec3f(	( i & 1 ) ? bounds.max[ 0 ] : bounds.min[ 0 ],
+									( i & 2 ) ? bounds.max[ 1 ] : bounds.min[ 1 ],
+									( i & 4 ) ? bounds.max[ 2 ] : bounds.min[ 2 ] );
+		outBounds.Expand( TransformPoint( m, corner ) );
+	}
+	return outBounds;
+}
+
 
 // ============================================================
 // Scene
 // ============================================================
 
+// Shading parameters unpacked from a Material once per scene commit. Hits
+// reach it through a per-triangle index instead of the asset library.
+struct rtMaterial_t
+{
+	vec4f		Kd;
+	vec4f		Ks;
+	vec4f		Ka;
+	float		Ns;
+	float		Tr;
+	bool		textured;
+	uint32_t	colorMapIx;	// RtScene::textures, InvalidTextureIx if untextured
+	Material	desc;		// Full description for BrdfGGX
+};
+
+static const uint32_t	MaxSceneMaterials	= 0xFFFF;
+
+// Bottom level acceleration for a shared model. Leaves of the hierarchy
+// reference ranges of packed triangle blocks instead of triangle indices.
+// Triangle data is split by access pattern: traversal only touches bvh and
+// triBlocks, and attributes are read once a hit is shaded. The blocks are
+// the only copy of the positions; the rasterizer and single-triangle tests
+// find a triangle's lane through triLanes. RtModel::triCache is released
+// once these are built. Accels are immutable once built and shared by every
+// snapshot, so anything that depends on the scene lives on RtScene.
+class RtModelAccel
+{
+public:
+	Bvh							bvh;
+	std::vector<triBlock_t>		triBlocks;
+	std::vector<uint32_t>		triLanes;			// Block * TriBlockWidth + lane per triangle
+	std::vector<triAttrib_t>	attribs;			// Quantized shading attributes per triangle
+	std::vector<hdl_t>			materialHdls;		// Distinct materials of the model
+	std::vector<uint16_t>		triMaterialSlots;	// Index into materialHdls per triangle
+
+	inline uint32_t GetTriCount() const
+	{
+		return static_cast<uint32_t>( attribs.size() );
+	}
+
+	inline const triBlock_t& GetTriBlock( const uint32_t triIx, uint32_t& outLane ) const
+	{
+		outLane = triLanes[ triIx ] % TriBlockWidth;
+		return triBlocks[ triLanes[ triIx ] / TriBlockWidth ];
+	}
+
+	// Object space
+	inline void GetTriPositions( const uint32_t triIx, vec3f outPts[ 3 ] ) const
+	{
+		uint32_t lane;
+		const triBlock_t& block = GetTriBlock( triIx, lane );
+		GetTriBlockLane( block, lane, outPts );
+	}
+};
+
+// Placement of a shared bottom-level model in the world
+class RtInstance
+{
+public:
+	mat4x4f		transform;		// Object to world
+	mat4x4f		invTransform;	// World to object
+	AABB		bounds;			// World space
+	uint32_t	modelIx;
+};
+
+// Trace workers only ever see a committed, read-only scene (see RtSceneBuilder).
+// Clone() shares model geometry and copies only per-snapshot state, which can
+// still be sizable, so copies must be asked for explicitly.
 class RtScene
 {
 public:
-	std::vector<RtModel>	models;
+	RtScene() = default;
+	RtScene( RtScene&& ) = default;
+	RtScene& operator=( RtScene&& ) = default;
+
+	RtScene( const RtScene& ) = delete;
+	RtScene& operator=( const RtScene& ) = delete;
+
+	inline RtScene Clone() const
+	{
+		RtScene copy;
+		copy.models = models;
+		copy.modelAccels = modelAccels;
+		copy.modelMaterials = modelMaterials;
+		copy.modelHdls = modelHdls;
+		copy.instances = instances;
+		copy.lights = lights;
+		copy.lightBvh = lightBvh;
+		copy.materials = materials;
+		copy.textures = textures;
+		copy.bvh = bvh;
+		copy.bvhBuildCost = bvhBuildCost;
+		copy.scene = scene;
+		copy.assets = assets;
+		return copy;
+	}
+
+	std::vector<std::shared_ptr<const RtModel>>			models;		// Bottom level, object space, one per Model handle
+	std::vector<std::shared_ptr<const RtModelAccel>>	modelAccels;	// Triangle hierarchy for each model
+	std::vector<std::vector<uint16_t>>	modelMaterials;	// Per model, index into materials for each material slot
+	std::vector<hdl_t>		modelHdls;
+	std::vector<RtInstance>	instances;
 	std::vector<light_t>	lights;
-	AABB					aabb;
+	LightBvh				lightBvh;	// Over lights, rebuilt on commit
+	std::vector<rtMaterial_t>	materials;	// Built by BuildMaterialTable on commit
+	std::shared_ptr<TextureCache>	textures;	// Shared by snapshots; commits fork it before adding images
+	Bvh						bvh;		// Top level SAH hierarchy over instances
+	float					bvhBuildCost = 0.0f;	// bvh.SahCost() when last built, refits are measured against it
 	const Scene*			scene;
 	AssetManager*			assets;
 };
 
+typedef std::shared_ptr<const RtScene> RtSceneRef;
+
 class RtView
 {
 public:
@@ -0,0 +1,176 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// sampler.h — Owen-scrambled Sobol sampler
+//
+// Requires: GfxCore vector types
+//
+// Every pixel gets its own sampler value seeded from the frame seed and the
+// pixel position, so workers share no RNG state and a frame is reproducible.
+// Dimensions are drawn in order within a sample: 2D draws come from the
+// first two Sobol dimensions with a per-dimension shuffle and scramble,
+// 1D draws from a scrambled van der Corput sequence.
+//
+
+#include <algorithm>
+#include <cstdint>
+#include <cmath>
+
+
+// ============================================================
+// Bit utilities
+// ============================================================
+
+inline uint32_t ReverseBits( uint32_t x )
+{
+	x = ( x << 16 ) | ( x >> 16 );
+	x = ( ( x & 0x00ff00ffu ) << 8 ) | ( ( x & 0xff00ff00u ) >> 8 );
+	x = ( ( x & 0x0f0f0f0fu ) << 4 ) | ( ( x & 0xf0f0f0f0u ) >> 4 );
+	x = ( ( x & 0x33333333u ) << 2 ) | ( ( x & 0xccccccccu ) >> 2 );
+	x = ( ( x & 0x55555555u ) << 1 ) | ( ( x & 0xaaaaaaaau ) >> 1 );
+	return x;
+}
+
+
+inline uint32_t HashU32( uint32_t x )
+{
+	x ^= x >> 16;
+	x *= 0x21f0aaadu;
+	x ^= x >> 15;
+	x *= 0x735a2d97u;
+	x ^= x >> 15;
+	return x;
+}
+
+
+inline uint32_t HashCombine( const uint32_t seed, const uint32_t v )
+{
+	return seed ^ ( v + 0x9e3779b9u + ( seed << 6 ) + ( seed >> 2 ) );
+}
+
+
+// Owen scrambling in base 2 (Laine-Karras style hash, Burley 2020)
+inline uint32_t NestedUniformScramble( uint32_t x, const uint32_t seed )
+{
+	x = ReverseBits( x );
+	x += seed;
+	x ^= x * 0x6c50b47cu;
+	x ^= x * 0xb82f1e52u;
+	x ^= x * 0xc7afe638u;
+	x ^= x * 0x8d22f6e6u;
+	return ReverseBits( x );
+}
+
+
+inline uint32_t SobolDim0( const uint32_t index )
+{
+	return ReverseBits( index );
+}
+
+
+inline uint32_t SobolDim1( uint32_t index )
+{
+	uint32_t result = 0;
+	for ( uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1 )
+	{
+		if ( index & 1 ) {
+			result ^= v;
+		}
+	}
+	return result;
+}
+
+
+inline float U32ToUnitFloat( const uint32_t x )
+{
+	// Top 24 bits so the result stays strictly below 1
+	return static_cast<float>( x >> 8 ) * ( 1.0f / 16777216.0f );
+}
+
+
+// ============================================================
+// Sampler
+// ============================================================
+
+class Sampler
+{
+public:
+	Sampler() : pixelSeed( 0 ), sampleIx( 0 ), dimension( 0 ) {}
+
+	Sampler( const uint32_t frameSeed, const uint32_t px, const uint32_t py )
+		: pixelSeed( HashU32( HashCombine( HashCombine( HashU32( frameSeed ), px ), py ) ) ), sampleIx( 0 ), dimension( 0 ) {}
+
+	inline void StartSample( const uint32_t index )
+	{
+		sampleIx = index;
+		dimension = 0;
+	}
+
+	inline uint32_t GetSampleIndex() const
+	{
+		return sampleIx;
+	}
+
+	inline float Next1D()
+	{
+		const uint32_t seed = DimensionSeed();
+		const uint32_t index = NestedUniformScramble( sampleIx, HashCombine( seed, 0 ) );
+		return U32ToUnitFloat( NestedUniformScramble( SobolDim0( index ), HashCombine( seed, 1 ) ) );
+	}
+
+	inline vec2f Next2D()
+	{
+		const uint32_t seed = DimensionSeed();
+		const uint32_t index = NestedUniformScramble( sampleIx, HashCombine( seed, 0 ) );
+		const float x = U32ToUnitFloat( NestedUniformScramble( SobolDim0( index ), HashCombine( seed, 1 ) ) );
+		const float y = U32ToUnitFloat( NestedUniformScramble( SobolDim1( index ), HashCombine( seed, 2 ) ) );
+		return vec2f( x, y );
+	}
+
+private:
+	inline uint32_t DimensionSeed()
+	{
+		return HashU32( HashCombine( pixelSeed, dimension++ ) );
+	}
+
+	uint32_t	pixelSeed;
+	uint32_t	sampleIx;
+	uint32_t	dimension;
+};
+
+
+// Uniform point inside a ball of the given radius
+inline vec3f SampleBall( Sampler& sampler, const float radius )
+{
+	const vec2f u = sampler.Next2D();
+	const float r = radius * std::cbrt( sampler.Next1D() );
+
+	const float z = 1.0f - 2.0f * u[ 0 ];
+	const float ringRadius = std::sqrt( std::max( 0.0f, 1.0f - z * z ) );
+	const float phi = 6.28318530718f * u[ 1 ];
+
+	return vec3f( r * ringRadius * std::cos( phi ), r * ringRadius * std::sin( phi ), r * z );
+}
@@ -0,0 +1,469 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// textureCache.h — Tiled, mip-mapped texture store
+//
+// Requires: GfxCore image and vector types
+//
+// Textures are sampled through 8x8 texel tiles. Tiles are numbered in Morton
+// order within each mip level and texels in Morton order within a tile, so
+// filtering footprints stay within a few cache lines. Tiles are built on
+// first use: level 0 tiles from the source image, higher levels from the
+// level below. Built tiles live in a bounded set-associative cache shared by
+// every thread, fronted by a small lock-free cache per thread.
+//
+// A cache's texture table is never modified while it may be sampled. Adding
+// textures to a published cache goes through Fork(), which copies the table
+// and shares the built tiles and source images with the original.
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+static const uint32_t	TexTileSize			= 8;
+static const uint32_t	TexTileTexels		= TexTileSize * TexTileSize;
+static const uint32_t	TexMaxLevels		= 16;
+static const uint32_t	TexCacheWays		= 4;
+static const uint32_t	TexLocalTiles		= 16;		// Per-thread tile cache entries, power of two
+static const size_t		TexDefaultBudget	= 64 * 1024 * 1024;
+static const uint32_t	InvalidTextureIx	= ~0u;
+
+
+// Packed sRGB RGBA8 texels of one tile, Morton ordered
+struct texTile_t
+{
+	uint32_t	texels[ TexTileTexels ];
+};
+
+
+// ============================================================
+// Texel utilities
+// ============================================================
+
+inline uint32_t MortonPart1By1( uint32_t x )
+{
+	x &= 0x0000ffff;
+	x = ( x | ( x << 8 ) ) & 0x00ff00ff;
+	x = ( x | ( x << 4 ) ) & 0x0f0f0f0f;
+	x = ( x | ( x << 2 ) ) & 0x33333333;
+	x = ( x | ( x << 1 ) ) & 0x55555555;
+	return x;
+}
+
+
+inline uint32_t MortonEncode2D( const uint32_t x, const uint32_t y )
+{
+	return MortonPart1By1( x ) | ( MortonPart1By1( y ) << 1 );
+}
+
+
+inline float SrgbToLinear8( const uint32_t c )
+{
+	struct lut_t
+	{
+		float values[ 256 ];
+		lut_t()
+		{
+			for ( uint32_t i = 0; i < 256; ++i )
+			{
+				const float s = i / 255.0f;
+				values[ i ] = ( s <= 0.04045f ) ? ( s / 12.92f ) : std::pow( ( s + 0.055f ) / 1.055f, 2.4f );
+			}
+		}
+	};
+	static const lut_t lut;
+	return lut.values[ c & 0xff ];
+}
+
+
+inline uint32_t LinearToSrgb8( const float l )
+{
+	const float c = std::min( std::max( l, 0.0f ), 1.0f );
+	const float s = ( c <= 0.0031308f ) ? ( c * 12.92f ) : ( 1.055f * std::pow( c, 1.0f / 2.4f ) - 0.055f );
+	return static_cast<uint32_t>( s * 255.0f + 0.5f );
+}
+
+
+// Color channels are sRGB encoded, alpha is linear
+inline vec4f UnpackTexel( const uint32_t texel )
+{
+	return vec4f( SrgbToLinear8( texel ), SrgbToLinear8( texel >> 8 ), SrgbToLinear8( texel >> 16 ), ( texel >> 24 ) / 255.0f );
+}
+
+
+inline uint32_t PackTexel( const vec4f& linear )
+{
+	const uint32_t a = static_cast<uint32_t>( std::min( std::max( linear[ 3 ], 0.0f ), 1.0f ) * 255.0f + 0.5f );
+	return LinearToSrgb8( linear[ 0 ] ) | ( LinearToSrgb8( linear[ 1 ] ) << 8 ) | ( LinearToSrgb8( linear[ 2 ] ) << 16 ) | ( a << 24 );
+}
+
+
+inline float UvArea( const vec2f& uv0, const vec2f& uv1, const vec2f& uv2 )
+{
+	const vec2f e1 = uv1 - uv0;
+	const vec2f e2 = uv2 - uv0;
+	return 0.5f * std::abs( e1[ 0 ] * e2[ 1 ] - e1[ 1 ] * e2[ 0 ] );
+}
+
+
+// Mip level where one texel covers a footprint of the given width. The areas
+// belong to the same triangle, surfaceArea in the footprint's units.
+inline float TextureLod( const vec2i& texSize, const float uvArea, const float surfaceArea, const float footprint )
+{
+	const float texelArea = uvArea * texSize[ 0 ] * texSize[ 1 ];
+	if ( ( texelArea <= 0.0f ) || ( surfaceArea <= 0.0f ) ) {
+		return 0.0f;
+	}
+	return 0.5f * std::log2( footprint * footprint * texelArea / surfaceArea );
+}
+
+
+// ============================================================
+// TextureCache
+// ============================================================
+
+class TextureCache
+{
+public:
+	explicit TextureCache( const size_t budgetBytes = TexDefaultBudget );
+
+	TextureCache( const TextureCache& ) = delete;
+	TextureCache& operator=( const TextureCache& ) = delete;
+
+	// New cache with the same textures and tile store; indices stay valid
+	std::shared_ptr<TextureCache>	Fork() const;
+
+	// Registers a source image once per sourceId. Pixels must convert to Color.
+	// Not safe while other threads sample this cache; fork a published one.
+	template<class PixelType>
+	uint32_t		AddTexture( const ImageBuffer<PixelType>& image, const uint64_t sourceId );
+	uint32_t		FindTexture( const uint64_t sourceId ) const;
+
+	vec4f			FetchTexel( const uint32_t texIx, const uint32_t level, int32_t x, int32_t y );
+	vec4f			SampleBilinear( const uint32_t texIx, const vec2f& uv, const uint32_t level );
+	vec4f			SampleTrilinear( const uint32_t texIx, const vec2f& uv, const float lod );
+
+	inline uint32_t GetLevelCount( const uint32_t texIx ) const
+	{
+		return textures[ texIx ]->levelCnt;
+	}
+
+	inline vec2i GetSize( const uint32_t texIx ) const
+	{
+		return vec2i( textures[ texIx ]->width, textures[ texIx ]->height );
+	}
+
+private:
+	struct texture_t
+	{
+		uint32_t				width;
+		uint32_t				height;
+		uint32_t				levelCnt;
+		std::vector<uint32_t>	source;		// Level 0, row-major packed texels
+	};
+
+	struct cacheWay_t
+	{
+		uint64_t	key;
+		uint64_t	lastUse;
+		texTile_t	tile;
+	};
+
+	struct cacheSet_t
+	{
+		std::mutex	lock;
+		cacheWay_t	ways[ TexCacheWays ];
+	};
+
+	// Built tiles, shared by a cache and its forks
+	struct tileStore_t
+	{
+		std::unique_ptr<cacheSet_t[]>	sets;
+		uint32_t						setCnt;
+		uint32_t						storeId;
+		std::atomic<uint64_t>			useClock;
+	};
+
+	struct localEntry_t
+	{
+		uint64_t	key;
+		texTile_t	tile;
+	};
+
+	uint64_t			TileKey( const uint32_t texIx, const uint32_t level, const uint32_t tileMorton ) const;
+	const texTile_t&	GetTile( const uint32_t texIx, const uint32_t level, const uint32_t tx, const uint32_t ty );
+	void				BuildTile( const uint32_t texIx, const uint32_t level, const uint32_t tx, const uint32_t ty, texTile_t& outTile );
+
+	struct forkTag_t {};
+	explicit TextureCache( forkTag_t ) {}
+
+	std::vector<std::shared_ptr<const texture_t>>	textures;
+	std::map<uint64_t, uint32_t>					sourceIds;
+	std::shared_ptr<tileStore_t>					store;
+};
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline TextureCache::TextureCache( const size_t budgetBytes )
+	: store( std::make_shared<tileStore_t>() )
+{
+	static std::atomic<uint32_t> nextStoreId( 1 );
+	store->storeId = nextStoreId++ & 0xfff;
+	store->useClock = 1;
+
+	store->setCnt = std::max( 1u, static_cast<uint32_t>( budgetBytes / ( TexCacheWays * sizeof( cacheWay_t ) ) ) );
+	store->sets.reset( new cacheSet_t[ store->setCnt ] );
+	for ( uint32_t s = 0; s < store->setCnt; ++s )
+	{
+		for ( uint32_t w = 0; w < TexCacheWays; ++w )
+		{
+			store->sets[ s ].ways[ w ].key = 0;
+			store->sets[ s ].ways[ w ].lastUse = 0;
+		}
+	}
+}
+
+
+inline std::shared_ptr<TextureCache> TextureCache::Fork() const
+{
+	// Forks only append, so a texture index means the same image in every
+	// cache sharing the store and cached tiles stay valid
+	std::shared_ptr<TextureCache> fork( new TextureCache( forkTag_t() ) );
+	fork->textures = textures;
+	fork->sourceIds = sourceIds;
+	fork->store = store;
+	return fork;
+}
+
+
+inline uint32_t TextureCache::FindTexture( const uint64_t sourceId ) const
+{
+	auto it = sourceIds.find( sourceId );
+	return ( it != sourceIds.end() ) ? it->second : InvalidTextureIx;
+}
+
+
+template<class PixelType>
+inline uint32_t TextureCache::AddTexture( const ImageBuffer<PixelType>& image, const uint64_t sourceId )
+{
+	auto it = sourceIds.find( sourceId );
+	if ( it != sourceIds.end() ) {
+		return it->second;
+	}
+
+	std::shared_ptr<texture_t> texture( new texture_t() );
+	texture->width = std::max( 1u, image.GetWidth() );
+	texture->height = std::max( 1u, image.GetHeight() );
+
+	uint32_t levelCnt = 1;
+	while ( ( levelCnt < TexMaxLevels ) && ( ( ( texture->width | texture->height ) >> levelCnt ) != 0 ) ) {
+		++levelCnt;
+	}
+	texture->levelCnt = levelCnt;
+
+	texture->source.resize( texture->width * texture->height, 0 );
+	for ( uint32_t y = 0; y < image.GetHeight(); ++y )
+	{
+		for ( uint32_t x = 0; x < image.GetWidth(); ++x )
+		{
+			// Channels keep their stored sRGB encoding
+			const vec4f c = ColorToVector( Color( image.GetPixel( x, y ) ) );
+			uint32_t texel = 0;
+			for ( uint32_t i = 0; i < 4; ++i ) {
+				texel |= static_cast<uint32_t>( std::min( std::max( c[ i ], 0.0f ), 1.0f ) * 255.0f + 0.5f ) << ( 8 * i );
+			}
+			texture->source[ y * texture->width + x ] = texel;
+		}
+	}
+
+	const uint32_t texIx = static_cast<uint32_t>( textures.size() );
+	textures.push_back( std::move( texture ) );
+	sourceIds[ sourceId ] = texIx;
+	return texIx;
+}
+
+
+inline uint64_t TextureCache::TileKey( const uint32_t texIx, const uint32_t level, const uint32_t tileMorton ) const
+{
+	// Zero is reserved for empty cache entries
+	return ( static_cast<uint64_t>( store->storeId ) << 52 ) | ( static_cast<uint64_t>( texIx & 0xfff ) << 40 ) | ( static_cast<uint64_t>( level ) << 32 ) | tileMorton;
+}
+
+
+inline const texTile_t& TextureCache::GetTile( const uint32_t texIx, const uint32_t level, const uint32_t tx, const uint32_t ty )
+{
+	const uint64_t key = TileKey( texIx, level, MortonEncode2D( tx, ty ) );
+	const uint64_t hash = key * 0x9e3779b97f4a7c15ull;
+
+	// Per-thread copies take no locks and survive shared cache evictions
+	thread_local localEntry_t localTiles[ TexLocalTiles ] = {};
+	localEntry_t& local = localTiles[ hash >> 60 & ( TexLocalTiles - 1 ) ];
+	if ( local.key == key ) {
+		return local.tile;
+	}
+
+	cacheSet_t& set = store->sets[ ( hash >> 32 ) % store->setCnt ];
+	{
+		std::lock_guard<std::mutex> guard( set.lock );
+		for ( uint32_t w = 0; w < TexCacheWays; ++w )
+		{
+			if ( set.ways[ w ].key == key )
+			{
+				set.ways[ w ].lastUse = store->useClock++;
+				local.tile = set.ways[ w ].tile;
+				local.key = key;
+				return local.tile;
+			}
+		}
+	}
+
+	// Build outside the lock; higher levels fetch from the level below
+	texTile_t tile;
+	BuildTile( texIx, level, tx, ty, tile );
+
+	{
+		std::lock_guard<std::mutex> guard( set.lock );
+		cacheWay_t* victim = &set.ways[ 0 ];
+		for ( uint32_t w = 0; w < TexCacheWays; ++w )
+		{
+			if ( set.ways[ w ].key == key ) {
+				victim = &set.ways[ w ];
+				break;
+			}
+			if ( set.ways[ w ].lastUse < victim->lastUse ) {
+				victim = &set.ways[ w ];
+			}
+		}
+		victim->key = key;
+		victim->lastUse = store->useClock++;
+		victim->tile = tile;
+	}
+
+	local.tile = tile;
+	local.key = key;
+	return local.tile;
+}
+
+
+inline void TextureCache::BuildTile( const uint32_t texIx, const uint32_t level, const uint32_t tx, const uint32_t ty, texTile_t& outTile )
+{
+	const texture_t& texture = *textures[ texIx ];
+	const uint32_t levelWidth = std::max( 1u, texture.width >> level );
+	const uint32_t levelHeight = std::max( 1u, texture.height >> level );
+
+	for ( uint32_t j = 0; j < TexTileSize; ++j )
+	{
+		for ( uint32_t i = 0; i < TexTileSize; ++i )
+		{
+			// Texels past the edge of the level repeat the last row/column
+			const uint32_t x = std::min( tx * TexTileSize + i, levelWidth - 1 );
+			const uint32_t y = std::min( ty * TexTileSize + j, levelHeight - 1 );
+
+			uint32_t texel;
+			if ( level == 0 )
+			{
+				texel = texture.source[ y * texture.width + x ];
+			}
+			else
+			{
+				// Box filter over the 2x2 footprint in the level below
+				const vec4f sum = FetchTexel( texIx, level - 1, 2 * x, 2 * y ) + FetchTexel( texIx, level - 1, 2 * x + 1, 2 * y )
+								+ FetchTexel( texIx, level - 1, 2 * x, 2 * y + 1 ) + FetchTexel( texIx, level - 1, 2 * x + 1, 2 * y + 1 );
+				texel = PackTexel( 0.25f * sum );
+			}
+			outTile.texels[ MortonEncode2D( i, j ) ] = texel;
+		}
+	}
+}
+
+
+inline vec4f TextureCache::FetchTexel( const uint32_t texIx, const uint32_t level, int32_t x, int32_t y )
+{
+	const texture_t& texture = *textures[ texIx ];
+	const int32_t levelWidth = static_cast<int32_t>( std::max( 1u, texture.width >> level ) );
+	const int32_t levelHeight = static_cast<int32_t>( std::max( 1u, texture.height >> level ) );
+
+	// Repeat addressing
+	x %= levelWidth;
+	y %= levelHeight;
+	x += ( x < 0 ) ? levelWidth : 0;
+	y += ( y < 0 ) ? levelHeight : 0;
+
+	const texTile_t& tile = GetTile( texIx, level, x / TexTileSize, y / TexTileSize );
+	return UnpackTexel( tile.texels[ MortonEncode2D( x % TexTileSize, y % TexTileSize ) ] );
+}
+
+
+inline vec4f TextureCache::SampleBilinear( const uint32_t texIx, const vec2f& uv, const uint32_t level )
+{
+	const texture_t& texture = *textures[ texIx ];
+	const float levelWidth = static_cast<float>( std::max( 1u, texture.width >> level ) );
+	const float levelHeight = static_cast<float>( std::max( 1u, texture.height >> level ) );
+
+	const float fx = uv[ 0 ] * levelWidth - 0.5f;
+	const float fy = uv[ 1 ] * levelHeight - 0.5f;
+	const float x0 = std::floor( fx );
+	const float y0 = std::floor( fy );
+	const float wx = fx - x0;
+	const float wy = fy - y0;
+
+	const int32_t ix = static_cast<int32_t>( x0 );
+	const int32_t iy = static_cast<int32_t>( y0 );
+
+	const vec4f t00 = FetchTexel( texIx, level, ix, iy );
+	const vec4f t10 = FetchTexel( texIx, level, ix + 1, iy );
+	const vec4f t01 = FetchTexel( texIx, level, ix, iy + 1 );
+	const vec4f t11 = FetchTexel( texIx, level, ix + 1, iy + 1 );
+
+	return ( ( 1.0f - wy ) * ( ( 1.0f - wx ) * t00 + wx * t10 ) ) + ( wy * ( ( 1.0f - wx ) * t01 + wx * t11 ) );
+}
+
+
+inline vec4f TextureCache::SampleTrilinear( const uint32_t texIx, const vec2f& uv, const float lod )
+{
+	const uint32_t maxLevel = textures[ texIx ]->levelCnt - 1;
+	const float level = std::min( std::max( lod, 0.0f ), static_cast<float>( maxLevel ) );
+
+	const uint32_t level0 = static_cast<uint32_t>( level );
+	const uint32_t level1 = std::min( level0 + 1, maxLevel );
+	const float w = level - level0;
+
+	const vec4f c0 = SampleBilinear( texIx, uv, level0 );
+	if ( ( w <= 0.0f ) || ( level1 == level0 ) ) {
+		return c0;
+	}
+	return ( 1.0f - w ) * c0 + w * SampleBilinear( texIx, uv, level1 );
+}
@@ -0,0 +1,236 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// threadPool.h — Persistent work-stealing thread pool
+//
+// Workers live for the lifetime of the pool. Each has its own task
+// deque: owners pop from the back, idle workers steal from the front
+// of the others. Wait() lets the calling thread help until every
+// submitted task has finished.
+//
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+class ThreadPool
+{
+public:
+	typedef std::function<void()> task_t;
+
+	explicit ThreadPool( const uint32_t threadCnt = 0 );
+	~ThreadPool();
+
+	ThreadPool( const ThreadPool& ) = delete;
+	ThreadPool& operator=( const ThreadPool& ) = delete;
+
+	void			Submit( task_t task );
+	void			Wait();
+
+	inline uint32_t GetThreadCount() const
+	{
+		return static_cast<uint32_t>( threads.size() );
+	}
+
+private:
+	struct worker_t
+	{
+		std::deque<task_t>	tasks;
+		std::mutex			lock;
+	};
+
+	bool			PopTask( const uint32_t workerIx, task_t& outTask );
+	bool			StealTask( const uint32_t workerIx, task_t& outTask );
+	void			RunTask( task_t& task );
+	void			WorkerLoop( const uint32_t workerIx );
+
+	std::vector<std::unique_ptr<worker_t>>	workers;
+	std::vector<std::thread>				threads;
+
+	std::mutex								sleepLock;
+	std::condition_variable					wakeSignal;
+	std::condition_variable					doneSignal;
+
+	std::atomic<uint32_t>					nextWorker;
+	std::atomic<uint32_t>					queuedCnt;
+	std::atomic<uint32_t>					pendingCnt;
+	std::atomic<bool>						shutdown;
+};
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline ThreadPool::ThreadPool( const uint32_t threadCnt )
+	: nextWorker( 0 ), queuedCnt( 0 ), pendingCnt( 0 ), shutdown( false )
+{
+	uint32_t workerCnt = threadCnt;
+	if ( workerCnt == 0 ) {
+		workerCnt = std::max( 1u, std::thread::hardware_concurrency() );
+	}
+
+	workers.reserve( workerCnt );
+	for ( uint32_t i = 0; i < workerCnt; ++i ) {
+		workers.push_back( std::unique_ptr<worker_t>( new worker_t() ) );
+	}
+
+	threads.reserve( workerCnt );
+	for ( uint32_t i = 0; i < workerCnt; ++i ) {
+		threads.push_back( std::thread( &ThreadPool::WorkerLoop, this, i ) );
+	}
+}
+
+
+inline ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		shutdown = true;
+	}
+	wakeSignal.notify_all();
+
+	for ( auto& thread : threads ) {
+		thread.join();
+	}
+}
+
+
+inline void ThreadPool::Submit( task_t task )
+{
+	const uint32_t workerIx = nextWorker++ % static_cast<uint32_t>( workers.size() );
+
+	// Counted before it is visible, so a pop can never take queuedCnt below zero
+	++pendingCnt;
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		++queuedCnt;
+	}
+
+	{
+		worker_t& worker = *workers[ workerIx ];
+		std::lock_guard<std::mutex> guard( worker.lock );
+		worker.tasks.push_back( std::move( task ) );
+	}
+	wakeSignal.notify_one();
+	doneSignal.notify_all();
+}
+
+
+inline void ThreadPool::Wait()
+{
+	// Help drain the queues rather than block straight away
+	task_t task;
+	while ( pendingCnt > 0 )
+	{
+		if ( StealTask( 0, task ) )
+		{
+			RunTask( task );
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard( sleepLock );
+		doneSignal.wait( guard, [this]() { return ( pendingCnt == 0 ) || ( queuedCnt > 0 ); } );
+	}
+}
+
+
+inline bool ThreadPool::PopTask( const uint32_t workerIx, task_t& outTask )
+{
+	worker_t& worker = *workers[ workerIx ];
+	std::lock_guard<std::mutex> guard( worker.lock );
+	if ( worker.tasks.empty() ) {
+		return false;
+	}
+
+	outTask = std::move( worker.tasks.back() );
+	worker.tasks.pop_back();
+	--queuedCnt;
+	return true;
+}
+
+
+inline bool ThreadPool::StealTask( const uint32_t workerIx, task_t& outTask )
+{
+	const uint32_t workerCnt = static_cast<uint32_t>( workers.size() );
+	for ( uint32_t i = 1; i <= workerCnt; ++i )
+	{
+		worker_t& victim = *workers[ ( workerIx + i ) % workerCnt ];
+		std::lock_guard<std::mutex> guard( victim.lock );
+		if ( victim.tasks.empty() ) {
+			continue;
+		}
+
+		outTask = std::move( victim.tasks.front() );
+		victim.tasks.pop_front();
+		--queuedCnt;
+		return true;
+	}
+	return false;
+}
+
+
+inline void ThreadPool::RunTask( task_t& task )
+{
+	task();
+	task = nullptr;
+
+	bool allDone;
+	{
+		std::lock_guard<std::mutex> guard( sleepLock );
+		allDone = ( --pendingCnt == 0 );
+	}
+
+	if ( allDone ) {
+		doneSignal.notify_all();
+	}
+}
+
+
+inline void ThreadPool::WorkerLoop( const uint32_t workerIx )
+{
+	task_t task;
+	while ( true )
+	{
+		if ( PopTask( workerIx, task ) || StealTask( workerIx, task ) )
+		{
+			RunTask( task );
+			continue;
+		}
+
+		std::unique_lock<std::mutex> guard( sleepLock );
+		wakeSignal.wait( guard, [this]() { return shutdown || ( queuedCnt > 0 ); } );
+		if ( shutdown && ( queuedCnt == 0 ) ) {
+			return;
+		}
+	}
+}
@@ -0,0 +1,219 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// triAttrib.h — Quantized triangle attributes
+//
+// Shading data that is only read once a hit is known, kept apart from the
+// positions traversal touches. Normals are octahedral encoded into two
+// 16-bit snorms, uvs are half floats and vertex colors are rgba8, which
+// brings a triangle's attributes down to 40 bytes.
+//
+
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <gfxcore/math/vector.h>
+
+
+struct vertexAttrib_t
+{
+	uint32_t	normal;		// EncodeOctNormal()
+	uint16_t	uv[ 2 ];	// Half floats
+	uint32_t	color;		// rgba8, linear
+};
+
+
+struct triAttrib_t
+{
+	vertexAttrib_t	v[ 3 ];
+	uint32_t		faceNormal;	// EncodeOctNormal()
+};
+
+
+// ============================================================
+// Forward declarations
+// ============================================================
+
+uint32_t	EncodeOctNormal( const vec3f& n );
+vec3f		DecodeOctNormal( const uint32_t packed );
+uint16_t	FloatToHalf( const float f );
+float		HalfToFloat( const uint16_t h );
+uint32_t	PackRgba8( const vec4f& color );
+vec4f		UnpackRgba8( const uint32_t packed );
+vertexAttrib_t	PackVertexAttrib( const vec3f& normal, const vec2f& uv, const vec4f& color );
+vec2f		UnpackUv( const vertexAttrib_t& attrib );
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline int16_t FloatToSnorm16( const float v )
+{
+	const float c = std::min( std::max( v, -1.0f ), 1.0f );
+	return static_cast<int16_t>( std::round( c * 32767.0f ) );
+}
+
+
+inline float Snorm16ToFloat( const int16_t v )
+{
+	return std::max( v / 32767.0f, -1.0f );
+}
+
+
+// Projects the unit sphere onto an octahedron and unfolds it into a square.
+// A zero normal has no direction to keep and comes back as +z.
+inline uint32_t EncodeOctNormal( const vec3f& n )
+{
+	const float l1 = std::abs( n[ 0 ] ) + std::abs( n[ 1 ] ) + std::abs( n[ 2 ] );
+	if ( l1 <= 0.0f ) {
+		return 0;
+	}
+
+	float x = n[ 0 ] / l1;
+	float y = n[ 1 ] / l1;
+	if ( n[ 2 ] < 0.0f )
+	{
+		const float fx = ( 1.0f - std::abs( y ) ) * ( ( x >= 0.0f ) ? 1.0f : -1.0f );
+		const float fy = ( 1.0f - std::abs( x ) ) * ( ( y >= 0.0f ) ? 1.0f : -1.0f );
+		x = fx;
+		y = fy;
+	}
+
+	const uint16_t qx = static_cast<uint16_t>( FloatToSnorm16( x ) );
+	const uint16_t qy = static_cast<uint16_t>( FloatToSnorm16( y ) );
+	return qx | ( static_cast<uint32_t>( qy ) << 16 );
+}
+
+
+inline vec3f DecodeOctNormal( const uint32_t packed )
+{
+	float x = Snorm16ToFloat( static_cast<int16_t>( packed & 0xFFFF ) );
+	float y = Snorm16ToFloat( static_cast<int16_t>( packed >> 16 ) );
+	const float z = 1.0f - std::abs( x ) - std::abs( y );
+	if ( z < 0.0f )
+	{
+		const float fx = ( 1.0f - std::abs( y ) ) * ( ( x >= 0.0f ) ? 1.0f : -1.0f );
+		const float fy = ( 1.0f - std::abs( x ) ) * ( ( y >= 0.0f ) ? 1.0f : -1.0f );
+		x = fx;
+		y = fy;
+	}
+
+	// Every decoded point lies on the octahedron, so len is never zero
+	const float len = std::sqrt( x * x + y * y + z * z );
+	return vec3f( x / len, y / len, z / len );
+}
+
+
+// Round to nearest even; out of range values become infinity
+inline uint16_t FloatToHalf( const float f )
+{
+	uint32_t bits;
+	std::memcpy( &bits, &f, sizeof( bits ) );
+
+	const uint32_t sign = ( bits >> 16 ) & 0x8000;
+	const uint32_t absBits = bits & 0x7FFFFFFF;
+
+	if ( absBits >= 0x7F800000 ) {
+		return static_cast<uint16_t>( sign | 0x7C00 | ( ( absBits > 0x7F800000 ) ? 0x200 : 0 ) );
+	}
+	if ( absBits >= 0x477FF000 ) {
+		return static_cast<uint16_t>( sign | 0x7C00 );
+	}
+	if ( absBits < 0x38800000 )
+	{
+		// Subnormal half, let the float unit do the rounding
+		float a;
+		std::memcpy( &a, &absBits, sizeof( a ) );
+		return static_cast<uint16_t>( sign | static_cast<uint32_t>( std::nearbyint( a * 16777216.0f ) ) );
+	}
+
+	const uint32_t mantissaOdd = ( absBits >> 13 ) & 1;
+	const uint32_t rounded = absBits + 0xC8000FFF + mantissaOdd;	// Rebias exponent and round
+	return static_cast<uint16_t>( sign | ( rounded >> 13 ) );
+}
+
+
+inline float HalfToFloat( const uint16_t h )
+{
+	const uint32_t sign = static_cast<uint32_t>( h & 0x8000 ) << 16;
+	const uint32_t exponent = ( h >> 10 ) & 0x1F;
+	const uint32_t mantissa = h & 0x3FF;
+
+	if ( exponent == 0 )
+	{
+		const float value = mantissa / 16777216.0f;
+		return sign ? -value : value;
+	}
+
+	uint32_t bits;
+	if ( exponent == 0x1F ) {
+		bits = sign | 0x7F800000 | ( mantissa << 13 );
+	} else {
+		bits = sign | ( ( exponent + 112 ) << 23 ) | ( mantissa << 13 );
+	}
+
+	float f;
+	std::memcpy( &f, &bits, sizeof( f ) );
+	return f;
+}
+
+
+inline uint32_t PackRgba8( const vec4f& color )
+{
+	uint32_t packed = 0;
+	for ( uint32_t c = 0; c < 4; ++c )
+	{
+		const float v = std::min( std::max( color[ c ], 0.0f ), 1.0f );
+		packed |= static_cast<uint32_t>( v * 255.0f + 0.5f ) << ( 8 * c );
+	}
+	return packed;
+}
+
+
+inline vec4f UnpackRgba8( const uint32_t packed )
+{
+	const float scale = 1.0f / 255.0f;
+	return vec4f( ( packed & 0xFF ) * scale, ( ( packed >> 8 ) & 0xFF ) * scale, ( ( packed >> 16 ) & 0xFF ) * scale, ( packed >> 24 ) * scale );
+}
+
+
+inline vertexAttrib_t PackVertexAttrib( const vec3f& normal, const vec2f& uv, const vec4f& color )
+{
+	vertexAttrib_t attrib;
+	attrib.normal = EncodeOctNormal( normal );
+	attrib.uv[ 0 ] = FloatToHalf( uv[ 0 ] );
+	attrib.uv[ 1 ] = FloatToHalf( uv[ 1 ] );
+	attrib.color = PackRgba8( color );
+	return attrib;
+}
+
+
+inline vec2f UnpackUv( const vertexAttrib_t& attrib )
+{
+	return vec2f( HalfToFloat( attrib.uv[ 0 ] ), HalfToFloat( attrib.uv[ 1 ] ) );
+}
@@ -0,0 +1,384 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// triBlock.h — Packed triangle blocks and wide ray/triangle kernels
+//
+// Triangles are stored eight at a time in structure-of-arrays form
+// holding only what Moller-Trumbore needs: one vertex and two edges.
+// The kernel is picked once at startup from CPUID: AVX2 tests a whole
+// block at once, SSE tests it in two halves.
+//
+
+#include <cstdint>
+#include <float.h>
+#include "bvh.h"
+
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __x86_64__ ) || defined( __i386__ )
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+#else
+#define RT_SIMD_X86 0
+#endif
+
+#if RT_SIMD_X86 && ( defined( __GNUC__ ) || defined( __clang__ ) )
+#define RT_TARGET_AVX2 __attribute__( ( target( "avx2" ) ) )
+#else
+#define RT_TARGET_AVX2
+#endif
+
+
+// ============================================================
+// Types
+// ============================================================
+
+static const uint32_t TriBlockWidth		= 8;
+static const uint32_t InvalidTriIx		= 0xFFFFFFFF;
+
+
+struct alignas( 32 ) triBlock_t
+{
+	float		p0[ 3 ][ TriBlockWidth ];
+	float		e1[ 3 ][ TriBlockWidth ];
+	float		e2[ 3 ][ TriBlockWidth ];
+	uint32_t	triIx[ TriBlockWidth ];	// InvalidTriIx for padding lanes
+};
+
+
+struct triBlockHit_t
+{
+	float		t;
+	float		u;
+	float		v;
+	uint32_t	triIx;
+	bool		isBackface;
+};
+
+
+typedef bool ( *triBlockKernel_t )( const triBlock_t& block, const traceRay_t& ray, const bool cullBackfaces, const float tMin, const float tMax, triBlockHit_t& outHit );
+
+
+// ============================================================
+// Packing
+// ============================================================
+
+inline void ClearTriBlock( triBlock_t& block )
+{
+	// Zero edges give a zero determinant so padding lanes never hit
+	for ( uint32_t lane = 0; lane < TriBlockWidth; ++lane )
+	{
+		for ( uint32_t i = 0; i < 3; ++i )
+		{
+			block.p0[ i ][ lane ] = 0.0f;
+			block.e1[ i ][ lane ] = 0.0f;
+			block.e2[ i ][ lane ] = 0.0f;
+		}
+		block.triIx[ lane ] = InvalidTriIx;
+	}
+}
+
+
+inline void SetTriBlockLane( triBlock_t& block, const uint32_t lane, const vec3f& p0, const vec3f& p1, const vec3f& p2, const uint32_t triIx )
+{
+	const vec3f e1 = p1 - p0;
+	const vec3f e2 = p2 - p0;
+	for ( uint32_t i = 0; i < 3; ++i )
+	{
+		block.p0[ i ][ lane ] = p0[ i ];
+		block.e1[ i ][ lane ] = e1[ i ];
+		block.e2[ i ][ lane ] = e2[ i ];
+	}
+	block.triIx[ lane ] = triIx;
+}
+
+
+// Moves a packed triangle between blocks without a round trip through its vertices
+inline void CopyTriBlockLane( triBlock_t& dst, const uint32_t dstLane, const triBlock_t& src, const uint32_t srcLane )
+{
+	for ( uint32_t i = 0; i < 3; ++i )
+	{
+		dst.p0[ i ][ dstLane ] = src.p0[ i ][ srcLane ];
+		dst.e1[ i ][ dstLane ] = src.e1[ i ][ srcLane ];
+		dst.e2[ i ][ dstLane ] = src.e2[ i ][ srcLane ];
+	}
+	dst.triIx[ dstLane ] = src.triIx[ srcLane ];
+}
+
+
+// Vertices as stored, p1 and p2 rebuilt from the edges
+inline void GetTriBlockLane( const triBlock_t& block, const uint32_t lane, vec3f outPts[ 3 ] )
+{
+	for ( uint32_t i = 0; i < 3; ++i )
+	{
+		outPts[ 0 ][ i ] = block.p0[ i ][ lane ];
+		outPts[ 1 ][ i ] = block.p0[ i ][ lane ] + block.e1[ i ][ lane ];
+		outPts[ 2 ][ i ] = block.p0[ i ][ lane ] + block.e2[ i ][ lane ];
+	}
+}
+
+
+// ============================================================
+// Kernels
+// ============================================================
+
+// Picks the nearest accepted lane from per-lane results
+inline bool ResolveTriBlockHit( const triBlock_t& block, uint32_t mask, const float* t, const float* u, const float* v, const float* det, const uint32_t laneOffset, float& tBest, triBlockHit_t& outHit )
+{
+	bool hit = false;
+	while ( mask != 0 )
+	{
+		uint32_t lane = 0;
+		while ( ( mask & ( 1u << lane ) ) == 0 ) {
+			++lane;
+		}
+		mask &= ~( 1u << lane );
+
+		if ( t[ lane ] < tBest )
+		{
+			tBest = t[ lane ];
+			outHit.t = t[ lane ];
+			outHit.u = u[ lane ];
+			outHit.v = v[ lane ];
+			outHit.triIx = block.triIx[ laneOffset + lane ];
+			outHit.isBackface = ( det[ lane ] < 0.0f );
+			hit = true;
+		}
+	}
+	return hit;
+}
+
+
+inline bool IntersectTriBlockScalar( const triBlock_t& block, const traceRay_t& ray, const bool cullBackfaces, const float tMin, const float tMax, triBlockHit_t& outHit )
+{
+	float tBest = tMax;
+	bool hit = false;
+	for ( uint32_t lane = 0; lane < TriBlockWidth; ++lane )
+	{
+		const vec3f p0 = vec3f( block.p0[ 0 ][ lane ], block.p0[ 1 ][ lane ], block.p0[ 2 ][ lane ] );
+		const vec3f e1 = vec3f( block.e1[ 0 ][ lane ], block.e1[ 1 ][ lane ], block.e1[ 2 ][ lane ] );
+		const vec3f e2 = vec3f( block.e2[ 0 ][ lane ], block.e2[ 1 ][ lane ], block.e2[ 2 ][ lane ] );
+
+		const vec3f pvec = Cross( ray.d, e2 );
+		const float det = Dot( e1, pvec );
+		if ( cullBackfaces ? ( det <= 0.0f ) : ( det == 0.0f ) ) {
+			continue;
+		}
+
+		const float invDet = 1.0f / det;
+		const vec3f tvec = ray.o - p0;
+		const float u = Dot( tvec, pvec ) * invDet;
+		const vec3f qvec = Cross( tvec, e1 );
+		const float v = Dot( ray.d, qvec ) * invDet;
+		const float t = Dot( e2, qvec ) * invDet;
+
+		if ( ( u < 0.0f ) || ( v < 0.0f ) || ( ( u + v ) > 1.0f ) || ( t <= tMin ) || ( t >= tBest ) ) {
+			continue;
+		}
+
+		tBest = t;
+		outHit.t = t;
+		outHit.u = u;
+		outHit.v = v;
+		outHit.triIx = block.triIx[ lane ];
+		outHit.isBackface = ( det < 0.0f );
+		hit = true;
+	}
+	return hit;
+}
+
+
+#if RT_SIMD_X86
+inline bool IntersectTriBlockSse( const triBlock_t& block, const traceRay_t& ray, const bool cullBackfaces, const float tMin, const float tMax, triBlockHit_t& outHit )
+{
+	const __m128 ox = _mm_set1_ps( ray.o[ 0 ] );
+	const __m128 oy = _mm_set1_ps( ray.o[ 1 ] );
+	const __m128 oz = _mm_set1_ps( ray.o[ 2 ] );
+	const __m128 dx = _mm_set1_ps( ray.d[ 0 ] );
+	const __m128 dy = _mm_set1_ps( ray.d[ 1 ] );
+	const __m128 dz = _mm_set1_ps( ray.d[ 2 ] );
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps( 1.0f );
+	const __m128 tMinV = _mm_set1_ps( tMin );
+
+	float tBest = tMax;
+	bool hit = false;
+	for ( uint32_t half = 0; half < TriBlockWidth; half += 4 )
+	{
+		const __m128 e1x = _mm_loadu_ps( &block.e1[ 0 ][ half ] );
+		const __m128 e1y = _mm_loadu_ps( &block.e1[ 1 ][ half ] );
+		const __m128 e1z = _mm_loadu_ps( &block.e1[ 2 ][ half ] );
+		const __m128 e2x = _mm_loadu_ps( &block.e2[ 0 ][ half ] );
+		const __m128 e2y = _mm_loadu_ps( &block.e2[ 1 ][ half ] );
+		const __m128 e2z = _mm_loadu_ps( &block.e2[ 2 ][ half ] );
+
+		// pvec = d x e2
+		const __m128 pvx = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ) );
+		const __m128 pvy = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ) );
+		const __m128 pvz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ) );
+		const __m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, pvx ), _mm_mul_ps( e1y, pvy ) ), _mm_mul_ps( e1z, pvz ) );
+
+		const __m128 tvx = _mm_sub_ps( ox, _mm_loadu_ps( &block.p0[ 0 ][ half ] ) );
+		const __m128 tvy = _mm_sub_ps( oy, _mm_loadu_ps( &block.p0[ 1 ][ half ] ) );
+		const __m128 tvz = _mm_sub_ps( oz, _mm_loadu_ps( &block.p0[ 2 ][ half ] ) );
+
+		// qvec = tvec x e1
+		const __m128 qvx = _mm_sub_ps( _mm_mul_ps( tvy, e1z ), _mm_mul_ps( tvz, e1y ) );
+		const __m128 qvy = _mm_sub_ps( _mm_mul_ps( tvz, e1x ), _mm_mul_ps( tvx, e1z ) );
+		const __m128 qvz = _mm_sub_ps( _mm_mul_ps( tvx, e1y ), _mm_mul_ps( tvy, e1x ) );
+
+		const __m128 invDet = _mm_div_ps( one, det );
+		const __m128 u = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tvx, pvx ), _mm_mul_ps( tvy, pvy ) ), _mm_mul_ps( tvz, pvz ) ), invDet );
+		const __m128 v = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qvx ), _mm_mul_ps( dy, qvy ) ), _mm_mul_ps( dz, qvz ) ), invDet );
+		const __m128 t = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qvx ), _mm_mul_ps( e2y, qvy ) ), _mm_mul_ps( e2z, qvz ) ), invDet );
+
+		__m128 valid = cullBackfaces ? _mm_cmpgt_ps( det, zero ) : _mm_cmpneq_ps( det, zero );
+		valid = _mm_and_ps( valid, _mm_cmpge_ps( u, zero ) );
+		valid = _mm_and_ps( valid, _mm_cmpge_ps( v, zero ) );
+		valid = _mm_and_ps( valid, _mm_cmple_ps( _mm_add_ps( u, v ), one ) );
+		valid = _mm_and_ps( valid, _mm_cmpgt_ps( t, tMinV ) );
+		valid = _mm_and_ps( valid, _mm_cmplt_ps( t, _mm_set1_ps( tBest ) ) );
+
+		const uint32_t mask = static_cast<uint32_t>( _mm_movemask_ps( valid ) );
+		if ( mask == 0 ) {
+			continue;
+		}
+
+		alignas( 16 ) float tLanes[ 4 ];
+		alignas( 16 ) float uLanes[ 4 ];
+		alignas( 16 ) float vLanes[ 4 ];
+		alignas( 16 ) float detLanes[ 4 ];
+		_mm_store_ps( tLanes, t );
+		_mm_store_ps( uLanes, u );
+		_mm_store_ps( vLanes, v );
+		_mm_store_ps( detLanes, det );
+
+		hit |= ResolveTriBlockHit( block, mask, tLanes, uLanes, vLanes, detLanes, half, tBest, outHit );
+	}
+	return hit;
+}
+
+
+RT_TARGET_AVX2 inline bool IntersectTriBlockAvx2( const triBlock_t& block, const traceRay_t& ray, const bool cullBackfaces, const float tMin, const float tMax, triBlockHit_t& outHit )
+{
+	const __m256 ox = _mm256_set1_ps( ray.o[ 0 ] );
+	const __m256 oy = _mm256_set1_ps( ray.o[ 1 ] );
+	const __m256 oz = _mm256_set1_ps( ray.o[ 2 ] );
+	const __m256 dx = _mm256_set1_ps( ray.d[ 0 ] );
+	const __m256 dy = _mm256_set1_ps( ray.d[ 1 ] );
+	const __m256 dz = _mm256_set1_ps( ray.d[ 2 ] );
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps( 1.0f );
+
+	const __m256 e1x = _mm256_load_ps( block.e1[ 0 ] );
+	const __m256 e1y = _mm256_load_ps( block.e1[ 1 ] );
+	const __m256 e1z = _mm256_load_ps( block.e1[ 2 ] );
+	const __m256 e2x = _mm256_load_ps( block.e2[ 0 ] );
+	const __m256 e2y = _mm256_load_ps( block.e2[ 1 ] );
+	const __m256 e2z = _mm256_load_ps( block.e2[ 2 ] );
+
+	// pvec = d x e2
+	const __m256 pvx = _mm256_sub_ps( _mm256_mul_ps( dy, e2z ), _mm256_mul_ps( dz, e2y ) );
+	const __m256 pvy = _mm256_sub_ps( _mm256_mul_ps( dz, e2x ), _mm256_mul_ps( dx, e2z ) );
+	const __m256 pvz = _mm256_sub_ps( _mm256_mul_ps( dx, e2y ), _mm256_mul_ps( dy, e2x ) );
+	const __m256 det = _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( e1x, pvx ), _mm256_mul_ps( e1y, pvy ) ), _mm256_mul_ps( e1z, pvz ) );
+
+	const __m256 tvx = _mm256_sub_ps( ox, _mm256_load_ps( block.p0[ 0 ] ) );
+	const __m256 tvy = _mm256_sub_ps( oy, _mm256_load_ps( block.p0[ 1 ] ) );
+	const __m256 tvz = _mm256_sub_ps( oz, _mm256_load_ps( block.p0[ 2 ] ) );
+
+	// qvec = tvec x e1
+	const __m256 qvx = _mm256_sub_ps( _mm256_mul_ps( tvy, e1z ), _mm256_mul_ps( tvz, e1y ) );
+	const __m256 qvy = _mm256_sub_ps( _mm256_mul_ps( tvz, e1x ), _mm256_mul_ps( tvx, e1z ) );
+	const __m256 qvz = _mm256_sub_ps( _mm256_mul_ps( tvx, e1y ), _mm256_mul_ps( tvy, e1x ) );
+
+	const __m256 invDet = _mm256_div_ps( one, det );
+	const __m256 u = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( tvx, pvx ), _mm256_mul_ps( tvy, pvy ) ), _mm256_mul_ps( tvz, pvz ) ), invDet );
+	const __m256 v = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( dx, qvx ), _mm256_mul_ps( dy, qvy ) ), _mm256_mul_ps( dz, qvz ) ), invDet );
+	const __m256 t = _mm256_mul_ps( _mm256_add_ps( _mm256_add_ps( _mm256_mul_ps( e2x, qvx ), _mm256_mul_ps( e2y, qvy ) ), _mm256_mul_ps( e2z, qvz ) ), invDet );
+
+	__m256 valid = cullBackfaces ? _mm256_cmp_ps( det, zero, _CMP_GT_OQ ) : _mm256_cmp_ps( det, zero, _CMP_NEQ_OQ );
+	valid = _mm256_and_ps( valid, _mm256_cmp_ps( u, zero, _CMP_GE_OQ ) );
+	valid = _mm256_and_ps( valid, _mm256_cmp_ps( v, zero, _CMP_GE_OQ ) );
+	valid = _mm256_and_ps( valid, _mm256_cmp_ps( _mm256_add_ps( u, v ), one, _CMP_LE_OQ ) );
+	valid = _mm256_and_ps( valid, _mm256_cmp_ps( t, _mm256_set1_ps( tMin ), _CMP_GT_OQ ) );
+	valid = _mm256_and_ps( valid, _mm256_cmp_ps( t, _mm256_set1_ps( tMax ), _CMP_LT_OQ ) );
+
+	const uint32_t mask = static_cast<uint32_t>( _mm256_movemask_ps( valid ) );
+	if ( mask == 0 ) {
+		return false;
+	}
+
+	alignas( 32 ) float tLanes[ TriBlockWidth ];
+	alignas( 32 ) float uLanes[ TriBlockWidth ];
+	alignas( 32 ) float vLanes[ TriBlockWidth ];
+	alignas( 32 ) float detLanes[ TriBlockWidth ];
+	_mm256_store_ps( tLanes, t );
+	_mm256_store_ps( uLanes, u );
+	_mm256_store_ps( vLanes, v );
+	_mm256_store_ps( detLanes, det );
+
+	float tBest = tMax;
+	return ResolveTriBlockHit( block, mask, tLanes, uLanes, vLanes, detLanes, 0, tBest, outHit );
+}
+
+
+inline bool CpuSupportsAvx2()
+{
+#if defined( _MSC_VER )
+	int info[ 4 ];
+	__cpuid( info, 0 );
+	if ( info[ 0 ] < 7 ) {
+		return false;
+	}
+
+	// AVX support and OS saving of the YMM registers
+	__cpuid( info, 1 );
+	const bool osxsave = ( info[ 2 ] & ( 1 << 27 ) ) != 0;
+	const bool avx = ( info[ 2 ] & ( 1 << 28 ) ) != 0;
+	if ( !osxsave || !avx || ( ( _xgetbv( 0 ) & 0x6 ) != 0x6 ) ) {
+		return false;
+	}
+
+	__cpuidex( info, 7, 0 );
+	return ( info[ 1 ] & ( 1 << 5 ) ) != 0;
+#else
+	return __builtin_cpu_supports( "avx2" );
+#endif
+}
+#endif
+
+
+inline triBlockKernel_t GetTriBlockKernel()
+{
+#if RT_SIMD_X86
+	static const triBlockKernel_t kernel = CpuSupportsAvx2() ? IntersectTriBlockAvx2 : IntersectTriBlockSse;
+#else
+	static const triBlockKernel_t kernel = IntersectTriBlockScalar;
+#endif
+	return kernel;
+}
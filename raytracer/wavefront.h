@@ -0,0 +1,337 @@
+/*
+* MIT License
+*
+* Copyright( c ) 2023-2026 Thomas Griebel
+* Permission is hereby granted, free of charge, to any person obtaining a copy
+* of this softwareand associated documentation files( the "Software" ), to deal
+* in the Software without restriction, including without limitation the rights
+* to use, copy, modify, merge, publish, distribute, sublicense, and /or sell
+* copies of the Software, and to permit persons to whom the Software is
+* furnished to do so, subject to the following conditions :
+*
+* The above copyright noticeand this permission notice shall be included in all
+* copies or substantial portions of the Software.
+*
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+
+#pragma once
+
+//
+// wavefront.h — Breadth-first ray stream integrator
+//
+// Requires: raytrace.h
+//
+// Alternative to the depth-first TracePath loop. Each tile runs its paths
+// in stages over the whole batch: intersect, sort hits by material, shade,
+// then trace the shadow rays and bounce rays the shading stage emitted.
+// Shading matches TraceScene; only the order of the work changes.
+//
+
+#include "raytrace.h"
+#include <algorithm>
+
+
+// Larger than the packet tiles so every stage works on a decent stream
+static const uint32_t	WavefrontTileSize	= 32;
+
+
+// One ray in flight. weight is the product of reflectance along the path.
+struct wavefrontPath_t
+{
+	Ray			ray;
+	Sampler		sampler;
+	float		weight;
+	uint32_t	accumIx;
+	uint32_t	depth;
+};
+
+
+// Surface hit waiting to be shaded
+struct wavefrontShade_t
+{
+	uint32_t	materialIx;
+	uint32_t	pathIx;
+	sample_t	surface;
+};
+
+
+// Light contribution that only lands if the segment to the light is clear
+struct wavefrontShadow_t
+{
+	traceRay_t	ray;
+	float		tMax;
+	uint32_t	accumIx;
+	Color		color;
+};
+
+
+// Per-tile stream buffers, reused across bounces
+struct wavefrontBatch_t
+{
+	std::vector<wavefrontPath_t>	paths;
+	std::vector<wavefrontPath_t>	nextPaths;
+	std::vector<hitRecord_t>		hits;
+	std::vector<wavefrontShade_t>	shadeQueue;
+	std::vector<wavefrontShadow_t>	shadowQueue;
+	std::vector<pixelAccum_t>		accum;
+};
+
+
+// ============================================================
+// Forward declarations
+// ============================================================
+
+void		WavefrontGenerate( const RtView& view, const vec2i& p0, const vec2i& p1, wavefrontBatch_t& batch );
+template<uint32_t Features>
+void		WavefrontIntersect( const RtScene& rtScene, wavefrontBatch_t& batch );
+template<uint32_t Features>
+void		WavefrontShade( const RtScene& rtScene, const renderSettings_t& settings, wavefrontBatch_t& batch );
+void		WavefrontShadows( const RtScene& rtScene, wavefrontBatch_t& batch );
+template<uint32_t Features>
+void		TraceTileWavefront( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, const vec2i& p0, const vec2i& p1 );
+void		TraceSceneWavefront( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg );
+
+
+typedef void ( *traceTileKernel_t )( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, const vec2i& p0, const vec2i& p1 );
+
+struct TraceTileWavefrontKernels
+{
+	typedef traceTileKernel_t kernel_t;
+
+	template<uint32_t Features>
+	static void Run( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, const vec2i& p0, const vec2i& p1 )
+	{
+		TraceTileWavefront<Features>( view, rtScene, settings, image, dbg, p0, p1 );
+	}
+};
+
+
+// ============================================================
+// Implementation
+// ============================================================
+
+inline void WavefrontGenerate( const RtView& view, const vec2i& p0, const vec2i& p1, wavefrontBatch_t& batch )
+{
+	const uint32_t width = p1[ 0 ] - p0[ 0 ];
+	const uint32_t height = p1[ 1 ] - p0[ 1 ];
+
+	batch.accum.resize( width * height );
+	batch.paths.clear();
+	batch.paths.reserve( width * height * SubSampleCnt );
+
+	for ( uint32_t accumIx = 0; accumIx < width * height; ++accumIx )
+	{
+		pixelAccum_t& accum = batch.accum[ accumIx ];
+		ClearAccum( accum );
+
+		const uint32_t px = p0[ 0 ] + ( accumIx % width );
+		const uint32_t py = p0[ 1 ] + ( accumIx / width );
+
+		for ( uint32_t s = 0; s < SubSampleCnt; ++s )
+		{
+			wavefrontPath_t path;
+			path.sampler = Sampler( SamplerSeed, px, py );
+			path.sampler.StartSample( s );
+			path.ray = GetPixelRay( view, px, py, SubPixelOffset( path.sampler ) );
+			path.weight = 1.0f;
+			path.accumIx = accumIx;
+			path.depth = 0;
+			batch.paths.push_back( path );
+		}
+	}
+}
+
+
+template<uint32_t Features>
+inline void WavefrontIntersect( const RtScene& rtScene, wavefrontBatch_t& batch )
+{
+	const size_t pathCnt = batch.paths.size();
+	batch.hits.resize( pathCnt );
+	batch.shadeQueue.clear();
+
+	for ( size_t i = 0; i < pathCnt; ++i )
+	{
+		wavefrontPath_t& path = batch.paths[ i ];
+		hitRecord_t& hit = batch.hits[ i ];
+		IntersectScene( path.ray, rtScene, true, false, hit );
+
+		if ( ( hit.hitCode == HIT_FRONTFACE ) || ( hit.hitCode == HIT_BACKFACE ) )
+		{
+			wavefrontShade_t shade;
+			shade.surface = RecordSurfaceInfo<Features>( path.ray, rtScene, hit );
+			shade.materialIx = shade.surface.materialIx;
+			shade.pathIx = static_cast<uint32_t>( i );
+			batch.shadeQueue.push_back( shade );
+			continue;
+		}
+
+		// Misses finish here; only primary rays feed the pixel's surface info
+		pixelAccum_t& accum = batch.accum[ path.accumIx ];
+		const sample_t sample = ShadeMiss<Features>( path.ray, hit );
+		if ( path.depth == 0 ) {
+			AccumulateSample( accum, sample );
+		} else {
+			accum.color += path.weight * sample.color;
+		}
+	}
+
+	// Group the stream by material so shading walks one material at a time
+	std::sort( batch.shadeQueue.begin(), batch.shadeQueue.end(), []( const wavefrontShade_t& a, const wavefrontShade_t& b ) -> bool
+	{
+		return ( a.materialIx < b.materialIx ) || ( ( a.materialIx == b.materialIx ) && ( a.pathIx < b.pathIx ) );
+	} );
+}
+
+
+template<uint32_t Features>
+inline void WavefrontShade( const RtScene& rtScene, const renderSettings_t& settings, wavefrontBatch_t& batch )
+{
+	batch.nextPaths.clear();
+	batch.shadowQueue.clear();
+
+	const size_t shadeCnt = batch.shadeQueue.size();
+	for ( size_t i = 0; i < shadeCnt; ++i )
+	{
+		const wavefrontShade_t& shade = batch.shadeQueue[ i ];
+		wavefrontPath_t& path = batch.paths[ shade.pathIx ];
+		const sample_t& surfaceSample = shade.surface;
+		pixelAccum_t& accum = batch.accum[ path.accumIx ];
+		const rtMaterial_t& material = rtScene.materials[ shade.materialIx ];
+
+		if ( path.depth == 0 )
+		{
+			sample_t info = surfaceSample;
+			info.color = Color::Black;
+			AccumulateSample( accum, info );
+		}
+
+		if ( Features & RENDER_RAYCAST )
+		{
+			accum.color += path.weight * surfaceSample.color;
+			continue;
+		}
+
+		const Color surfaceColor = material.textured ? surfaceSample.albedo : surfaceSample.color;
+
+		vec3f viewVector = path.ray.GetVector().Reverse();
+		viewVector = Normalize( viewVector );
+
+		if ( ( Features & RENDER_REFLECTION ) && ( path.depth < settings.maxBounces ) && ( material.Tr > 0.0f ) )
+		{
+			vec3f reflectVector = ReflectVector( surfaceSample.normal, viewVector );
+			reflectVector += SampleBall( path.sampler, 0.1f );
+			reflectVector = MaxT * reflectVector;
+
+			wavefrontPath_t bounce;
+			bounce.ray = Ray( surfaceSample.pt, surfaceSample.pt + reflectVector );
+			bounce.sampler = path.sampler;
+			bounce.weight = path.weight * material.Tr;
+			bounce.accumIx = path.accumIx;
+			bounce.depth = path.depth + 1;
+			if ( SurvivesRoulette( settings, bounce.depth, bounce.weight, bounce.sampler ) ) {
+				batch.nextPaths.push_back( bounce );
+			}
+			continue;
+		}
+
+		ForEachLightSample( rtScene, surfaceSample, path.sampler, [&]( const light_t& L, const float weight )
+		{
+			const vec3f lightPos = Trunc<4,1>( L.pos );
+			const vec3f toLight = lightPos - surfaceSample.pt;
+
+			wavefrontShadow_t shadow;
+			shadow.color = ( path.weight * weight ) * ShadeLight( surfaceSample, material, surfaceColor, viewVector, L, toLight );
+			shadow.accumIx = path.accumIx;
+			if ( Features & RENDER_SHADOWS )
+			{
+				shadow.ray = MakeTraceRay( surfaceSample.pt, toLight );
+				shadow.tMax = 1.0f - MinT;
+				batch.shadowQueue.push_back( shadow );
+			}
+			else
+			{
+				accum.color += shadow.color;
+			}
+		} );
+
+		const Color ambient = AmbientLight * Vec4ToColor( Multiply( material.Ka, ColorToVector( surfaceColor ) ) );
+		accum.color += path.weight * ambient;
+	}
+}
+
+
+inline void WavefrontShadows( const RtScene& rtScene, wavefrontBatch_t& batch )
+{
+	const size_t shadowCnt = batch.shadowQueue.size();
+	for ( size_t i = 0; i < shadowCnt; ++i )
+	{
+		const wavefrontShadow_t& shadow = batch.shadowQueue[ i ];
+		if ( !Occluded( shadow.ray, rtScene, MinT, shadow.tMax ) ) {
+			batch.accum[ shadow.accumIx ].color += shadow.color;
+		}
+	}
+}
+
+
+template<uint32_t Features>
+inline void TraceTileWavefront( const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg, const vec2i& p0, const vec2i& p1 )
+{
+	const vec2i p1Clamped = vec2i( std::min( static_cast<uint32_t>( p1[ 0 ] ), image.GetWidth() ), std::min( static_cast<uint32_t>( p1[ 1 ] ), image.GetHeight() ) );
+	if ( ( p1Clamped[ 0 ] <= p0[ 0 ] ) || ( p1Clamped[ 1 ] <= p0[ 1 ] ) ) {
+		return;
+	}
+
+	// Buffers live per worker so their capacity carries over between tiles
+	thread_local wavefrontBatch_t batch;
+	WavefrontGenerate( view, p0, p1Clamped, batch );
+
+	while ( !batch.paths.empty() )
+	{
+		WavefrontIntersect<Features>( rtScene, batch );
+		WavefrontShade<Features>( rtScene, settings, batch );
+		WavefrontShadows( rtScene, batch );
+		batch.paths.swap( batch.nextPaths );
+	}
+
+	thread_local tileBuffer_t tile;
+	BeginTile( tile, p0, p1Clamped, dbg.aov.GetPassMask() );
+
+	const uint32_t width = p1Clamped[ 0 ] - p0[ 0 ];
+	const uint32_t pixelCnt = static_cast<uint32_t>( batch.accum.size() );
+	for ( uint32_t accumIx = 0; accumIx < pixelCnt; ++accumIx ) {
+		ResolvePixel( tile, p0[ 0 ] + ( accumIx % width ), p0[ 1 ] + ( accumIx / width ), batch.accum[ accumIx ] );
+	}
+	WriteTile<Features>( tile, image, dbg );
+}
+
+
+inline void TraceSceneWavefront( ThreadPool& pool, const RtView& view, const RtScene& rtScene, const renderSettings_t& settings, ImageBuffer<Color>& image, debug_t& dbg )
+{
+#if USE_RAYTRACE
+	const traceTileKernel_t TraceTileKernel = SelectKernel<TraceTileWavefrontKernels>( GetRenderFeatures( settings ) );
+
+	const uint32_t renderWidth = view.targetSize[ 0 ];
+	const uint32_t renderHeight = view.targetSize[ 1 ];
+	dbg.aov.Init( settings.aovMask, renderWidth, renderHeight );
+
+	for ( uint32_t py = 0; py < renderHeight; py += WavefrontTileSize )
+	{
+		for ( uint32_t px = 0; px < renderWidth; px += WavefrontTileSize )
+		{
+			const vec2i p0 = vec2i( px, py );
+			const vec2i p1 = vec2i( Clamp( px + WavefrontTileSize, px, renderWidth ), Clamp( py + WavefrontTileSize, py, renderHeight ) );
+
+			pool.Submit( [ &, p0, p1 ]() { TraceTileKernel( view, rtScene, settings, image, dbg, p0, p1 ); } );
+		}
+	}
+
+	pool.Wait();
+#endif
+}